@@ -0,0 +1,160 @@
+/*
+ * File:   can_capture.c
+ *
+ * Raw capture of every received CAN frame. The ring buffer absorbs bursts on
+ * the bus while the sd card is busy. There is a single producer (the CAN
+ * receive path) and a single consumer (the sd logger).
+ *
+ * In the triggered mode the producer drops the oldest record when the ring is
+ * full, so the ring always holds the last frames. A trigger opens a window: the
+ * records of the last CAN_CAPTURE_PRE_TRIGGER_MS are kept and from then on the
+ * ring works as in the other mode until the window ends. Both sides run in the
+ * main loop, so the producer can move the tail.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "can_capture.h"
+#include "softwaretimer.h"
+
+static can_capture_record_t can_capture_ring[CAN_CAPTURE_RING_SIZE];
+static volatile uint8_t can_capture_head = 0;      // Written by the producer
+static volatile uint8_t can_capture_tail = 0;      // Written by the consumer, in the triggered mode by both
+static uint16_t can_capture_sequence = 0;
+static uint8_t can_capture_lost = 0;
+static uint8_t can_capture_stored = 0;             // The last frame was stored
+static uint8_t can_capture_mode = CAN_CAPTURE_OFF;
+static uint8_t can_capture_window_open = 0;
+static uint32_t can_capture_window_start = 0;       // Time of the first trigger of the window
+static uint32_t can_capture_window_end = 0;         // Time of the last frame of the window
+
+void can_capture_set_mode(uint8_t mode) {
+    can_capture_mode = mode;
+    can_capture_window_open = 0;
+}
+
+uint8_t can_capture_get_mode(void) {
+    return can_capture_mode;
+}
+
+uint8_t can_capture_is_enabled(void) {
+    return can_capture_mode != CAN_CAPTURE_OFF;
+}
+
+// Returns 1 when a record was received after the end of the window
+static uint8_t can_capture_after_window(const can_capture_record_t *record) {
+    return (int32_t)(record->timestamp_ms - can_capture_window_end) > 0;
+}
+
+void can_capture_add(const uCAN_MSG *msg, uint32_t timestamp_ms) {
+    can_capture_record_t *record;
+    uint8_t head = can_capture_head;
+    
+    if (can_capture_mode == CAN_CAPTURE_OFF) {
+        return;
+    }
+    
+    can_capture_sequence++;
+    can_capture_stored = 0;
+    
+    // Drop the frame when the ring is full. The next record gets the lost flag.
+    // Outside a window, or when the oldest record is from before the trigger,
+    // the oldest record makes room. The frames after a trigger matter most.
+    if ((uint8_t)(head - can_capture_tail) >= CAN_CAPTURE_RING_SIZE) {
+        if (can_capture_mode == CAN_CAPTURE_TRIGGERED && (!can_capture_window_open ||
+                (int32_t)(can_capture_ring[can_capture_tail & (CAN_CAPTURE_RING_SIZE - 1)].timestamp_ms - can_capture_window_start) < 0)) {
+            can_capture_tail++;
+        } else {
+            can_capture_lost = 1;
+            return;
+        }
+    }
+    
+    record = &can_capture_ring[head & (CAN_CAPTURE_RING_SIZE - 1)];
+    record->timestamp_ms = timestamp_ms;
+    record->id = msg->frame.id;
+    if (msg->frame.idType == CAN_FRAME_EXT) {
+        record->id |= CAN_CAPTURE_ID_EXTENDED;
+    }
+    record->sequence = can_capture_sequence;
+    record->dlc = msg->frame.dlc;
+    record->flags = 0;
+    if (msg->frame.msgtype == CAN_MSG_RTR) {
+        record->flags |= CAN_CAPTURE_FLAG_RTR;
+    }
+    if (can_capture_lost) {
+        record->flags |= CAN_CAPTURE_FLAG_LOST;
+        can_capture_lost = 0;
+    }
+    record->data[0] = msg->frame.data0;
+    record->data[1] = msg->frame.data1;
+    record->data[2] = msg->frame.data2;
+    record->data[3] = msg->frame.data3;
+    record->data[4] = msg->frame.data4;
+    record->data[5] = msg->frame.data5;
+    record->data[6] = msg->frame.data6;
+    record->data[7] = msg->frame.data7;
+    
+    // Publish the record
+    can_capture_head = head + 1;
+    can_capture_stored = 1;
+}
+
+uint8_t can_capture_get(can_capture_record_t *record) {
+    uint8_t tail = can_capture_tail;
+    
+    if (tail == can_capture_head) {
+        return 0;
+    }
+    // Records after the window stay for the next one
+    if (can_capture_mode == CAN_CAPTURE_TRIGGERED && (!can_capture_window_open ||
+            can_capture_after_window(&can_capture_ring[tail & (CAN_CAPTURE_RING_SIZE - 1)]))) {
+        return 0;
+    }
+    *record = can_capture_ring[tail & (CAN_CAPTURE_RING_SIZE - 1)];
+    can_capture_tail = tail + 1;
+    return 1;
+}
+
+void can_capture_trigger(uint32_t timestamp_ms) {
+    if (can_capture_mode != CAN_CAPTURE_TRIGGERED) {
+        return;
+    }
+    if (can_capture_stored) {
+        can_capture_ring[(uint8_t)(can_capture_head - 1) & (CAN_CAPTURE_RING_SIZE - 1)].flags |= CAN_CAPTURE_FLAG_TRIGGER;
+    }
+    // Leave out the records from before the pre-trigger time
+    if (!can_capture_window_open) {
+        while (can_capture_tail != can_capture_head &&
+                timestamp_ms - can_capture_ring[can_capture_tail & (CAN_CAPTURE_RING_SIZE - 1)].timestamp_ms > CAN_CAPTURE_PRE_TRIGGER_MS) {
+            can_capture_tail++;
+        }
+        can_capture_window_open = 1;
+        can_capture_window_start = timestamp_ms;
+    }
+    can_capture_window_end = timestamp_ms + CAN_CAPTURE_POST_TRIGGER_MS;
+}
+
+uint8_t can_capture_get_window(void) {
+    uint8_t tail = can_capture_tail;
+    
+    if (!can_capture_window_open) {
+        return CAN_CAPTURE_WINDOW_NONE;
+    }
+    // The window ends when its time is over and its last record was taken
+    if ((int32_t)(softwaretimer_get_ms() - can_capture_window_end) > 0 && (tail == can_capture_head ||
+            can_capture_after_window(&can_capture_ring[tail & (CAN_CAPTURE_RING_SIZE - 1)]))) {
+        can_capture_window_open = 0;
+        return CAN_CAPTURE_WINDOW_ENDED;
+    }
+    return CAN_CAPTURE_WINDOW_OPEN;
+}
+
+void can_capture_file_header(can_capture_record_t *header) {
+    uint8_t *raw = (uint8_t *)header;
+    
+    memset(header, 0, sizeof(can_capture_record_t));
+    memcpy(raw, CAN_CAPTURE_FILE_MAGIC, 4);
+    raw[4] = CAN_CAPTURE_FILE_VERSION;
+    raw[5] = sizeof(can_capture_record_t);
+}
@@ -0,0 +1,104 @@
+/* 
+ * File:                can_capture.h
+ * Comments:            Raw capture of every received CAN frame.
+ *                      Frames are stored in a ring buffer by the CAN receive path
+ *                      and taken out by the sd logger. In the triggered mode the
+ *                      ring holds the last frames and only the frames of a window
+ *                      around a trigger are taken out.
+ */
+
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef CAN_CAPTURE_H
+#define	CAN_CAPTURE_H
+
+#include <stdint.h>
+#include "mcc_generated_files/can_types.h"
+
+// Number of records in the ring buffer. Needs to be a power of 2, at most 128.
+// In the triggered mode this limits the frames before a trigger, 20 bytes of RAM each.
+#define CAN_CAPTURE_RING_SIZE       64
+
+// Capture modes
+#define CAN_CAPTURE_OFF             0
+#define CAN_CAPTURE_ALL             1       // Every frame
+#define CAN_CAPTURE_TRIGGERED       2       // The frames of a window around each trigger
+
+// A window holds the frames of this long before the first trigger, as far as they
+// fit in the ring, up to this long after the last trigger. A trigger within the
+// window makes it longer.
+#define CAN_CAPTURE_PRE_TRIGGER_MS  1000
+#define CAN_CAPTURE_POST_TRIGGER_MS 2000
+
+// Window states, see can_capture_get_window()
+#define CAN_CAPTURE_WINDOW_NONE     0
+#define CAN_CAPTURE_WINDOW_OPEN     1       // Records of the window can be taken
+#define CAN_CAPTURE_WINDOW_ENDED    2       // All records of the window were taken
+
+// Set in the id of a record when the frame used a 29 bit extended id
+#define CAN_CAPTURE_ID_EXTENDED     0x80000000UL
+
+// Record flags
+#define CAN_CAPTURE_FLAG_RTR        0x01    // Remote transmission request
+#define CAN_CAPTURE_FLAG_LOST       0x02    // Frames were lost before this one because the ring was full
+#define CAN_CAPTURE_FLAG_TRIGGER    0x04    // A value in this frame fired a trigger
+
+// Capture file layout:
+// A header of one record size, followed by records. All values little endian.
+// Header: magic "SFRC", version, record size, reserved bytes (0)
+#define CAN_CAPTURE_FILE_MAGIC      "SFRC"
+#define CAN_CAPTURE_FILE_VERSION    1
+
+// One received frame. 20 bytes without padding on both the dsPIC and a PC.
+typedef struct {
+    uint32_t timestamp_ms;  // Receive time since boot
+    uint32_t id;            // CAN id, CAN_CAPTURE_ID_EXTENDED set for extended ids
+    uint16_t sequence;      // Counts every received frame, gaps show lost frames
+    uint8_t dlc;
+    uint8_t flags;
+    uint8_t data[8];
+} can_capture_record_t;
+
+// Sets the capture mode. With CAN_CAPTURE_OFF frames are not stored.
+// Parameters:
+//  mode            CAN_CAPTURE_OFF, CAN_CAPTURE_ALL or CAN_CAPTURE_TRIGGERED
+void can_capture_set_mode(uint8_t mode);
+
+// Returns the capture mode
+uint8_t can_capture_get_mode(void);
+
+// Returns 1 when the capture is enabled in any mode
+uint8_t can_capture_is_enabled(void);
+
+// Stores a received frame in the ring buffer.
+// Parameters:
+//  *msg            The received frame
+//  timestamp_ms    The time the frame was received, softwaretimer_get_ms()
+void can_capture_add(const uCAN_MSG *msg, uint32_t timestamp_ms);
+
+// Takes the oldest record out of the ring buffer. In the triggered mode only
+// the records of an open window are taken.
+// Parameters:
+//  *record         Filled with the record
+// Returns:
+//  1 when a record was returned, 0 when the ring buffer is empty.
+uint8_t can_capture_get(can_capture_record_t *record);
+
+// Opens a window in the triggered mode, or makes the open one longer. The last
+// stored frame is flagged with CAN_CAPTURE_FLAG_TRIGGER. Called by the decode
+// path of the frame that fired the trigger.
+// Parameters:
+//  timestamp_ms    The receive time of that frame, the window is timed from it
+void can_capture_trigger(uint32_t timestamp_ms);
+
+// Returns the state of the window, CAN_CAPTURE_WINDOW_*. CAN_CAPTURE_WINDOW_ENDED
+// is returned once, after the last record of the window was taken.
+uint8_t can_capture_get_window(void);
+
+// Fills a file header record
+// Parameters:
+//  *header         Filled with the header
+void can_capture_file_header(can_capture_record_t *header);
+
+#endif	/* CAN_CAPTURE_H */
+
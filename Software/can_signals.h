@@ -0,0 +1,251 @@
+/*
+ * File:                can_signals.h
+ * Comments:            Generated by Tools/signal_gen from can_signals.csv, do not edit.
+ */
+
+#ifndef CAN_SIGNALS_H
+#define	CAN_SIGNALS_H
+
+// Structs with the decoded values, S(name, dims). Dims is empty or the array size.
+#define CAN_STRUCTS(S) \
+    S(mg_battery, ) \
+    S(mg_mppt, [10]) \
+    S(sls, ) \
+    S(foil_control, )
+
+// Fields of each struct, F(type, name, dims)
+#define CAN_FIELDS_mg_battery(F) \
+    F(uint16_t, voltage_mv, ) \
+    F(int16_t, current_10ma, ) \
+    F(int16_t, discharge_current_10ma, ) \
+    F(int16_t, charge_current_10ma, ) \
+    F(uint8_t, soc, ) \
+    F(uint16_t, time_to_go_min, ) \
+    F(uint32_t, bms_state, ) \
+    F(uint8_t, temp, [4]) \
+    F(uint16_t, cell_voltage_mv, [12]) \
+    F(uint8_t, power_level, )
+
+#define CAN_FIELDS_mg_mppt(F) \
+    F(int16_t, current_in_ma, ) \
+    F(uint16_t, voltage_in_mv, ) \
+    F(uint16_t, voltage_out_mv, ) \
+    F(int16_t, power_in_100mw, )
+
+#define CAN_FIELDS_sls(F) \
+    F(uint32_t, status, ) \
+    F(uint32_t, limiting, ) \
+    F(int16_t, temp_power_100mdeg, ) \
+    F(int16_t, temp_electronics_100mdeg, ) \
+    F(int16_t, temp_motor_1_100mdeg, ) \
+    F(int16_t, temp_motor_2_100mdeg, ) \
+    F(uint16_t, uzk_10mv, ) \
+    F(int16_t, motor_current_100ma, ) \
+    F(int16_t, input_currect_100ma, ) \
+    F(int16_t, rpm, )
+
+#define CAN_FIELDS_foil_control(F) \
+    F(uint16_t, primary_input_position, ) \
+    F(uint16_t, primary_output_position, )
+
+// Decoded values, X(id, index, sub_index, offset, type, scale, target, aggregate, trigger).
+// Aggregate is the position in CAN_AGGREGATE_TABLE, -1 when the value is not aggregated.
+// Trigger is the position in CAN_TRIGGER_TABLE, -1 when the value has no trigger.
+// CANopen values sorted by COB-ID, index and sub-index
+#define CAN_CANOPEN_SIGNALS     76
+#define CAN_CANOPEN_TABLE(X) \
+    X(0x184, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[0].current_in_ma, -1, -1) \
+    X(0x184, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[0].voltage_in_mv, -1, -1) \
+    X(0x185, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[1].current_in_ma, -1, -1) \
+    X(0x185, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[1].voltage_in_mv, -1, -1) \
+    X(0x186, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[2].current_in_ma, -1, -1) \
+    X(0x186, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[2].voltage_in_mv, -1, -1) \
+    X(0x187, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[3].current_in_ma, -1, -1) \
+    X(0x187, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[3].voltage_in_mv, -1, -1) \
+    X(0x188, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[4].current_in_ma, -1, -1) \
+    X(0x188, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[4].voltage_in_mv, -1, -1) \
+    X(0x189, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[5].current_in_ma, -1, -1) \
+    X(0x189, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[5].voltage_in_mv, -1, -1) \
+    X(0x18A, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[6].current_in_ma, -1, -1) \
+    X(0x18A, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[6].voltage_in_mv, -1, -1) \
+    X(0x18B, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[7].current_in_ma, -1, -1) \
+    X(0x18B, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[7].voltage_in_mv, -1, -1) \
+    X(0x18C, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[8].current_in_ma, -1, -1) \
+    X(0x18C, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[8].voltage_in_mv, -1, -1) \
+    X(0x18D, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_I16, 0, mg_mppt[9].current_in_ma, -1, -1) \
+    X(0x18D, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_U16, 3, mg_mppt[9].voltage_in_mv, -1, -1) \
+    X(0x190, 0x2000, 0x01, 4, CAN_TYPE_U32, 0, sls.status, -1, 1) \
+    X(0x190, 0x2001, 0x01, 4, CAN_TYPE_U32, 0, sls.limiting, -1, 2) \
+    X(0x202, 0x0000, 0x00, 0, CAN_TYPE_U8, 0, mg_battery.power_level, -1, -1) \
+    X(0x284, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[0].voltage_out_mv, -1, -1) \
+    X(0x284, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[0].power_in_100mw, -1, -1) \
+    X(0x285, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[1].voltage_out_mv, -1, -1) \
+    X(0x285, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[1].power_in_100mw, -1, -1) \
+    X(0x286, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[2].voltage_out_mv, -1, -1) \
+    X(0x286, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[2].power_in_100mw, -1, -1) \
+    X(0x287, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[3].voltage_out_mv, -1, -1) \
+    X(0x287, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[3].power_in_100mw, -1, -1) \
+    X(0x288, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[4].voltage_out_mv, -1, -1) \
+    X(0x288, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[4].power_in_100mw, -1, -1) \
+    X(0x289, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[5].voltage_out_mv, -1, -1) \
+    X(0x289, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[5].power_in_100mw, -1, -1) \
+    X(0x28A, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[6].voltage_out_mv, -1, -1) \
+    X(0x28A, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[6].power_in_100mw, -1, -1) \
+    X(0x28B, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[7].voltage_out_mv, -1, -1) \
+    X(0x28B, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[7].power_in_100mw, -1, -1) \
+    X(0x28C, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[8].voltage_out_mv, -1, -1) \
+    X(0x28C, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[8].power_in_100mw, -1, -1) \
+    X(0x28D, 0x0000, 0x00, 0, CAN_TYPE_FLOAT_U16, 3, mg_mppt[9].voltage_out_mv, -1, -1) \
+    X(0x28D, 0x0000, 0x00, 4, CAN_TYPE_FLOAT_I16, -2, mg_mppt[9].power_in_100mw, -1, -1) \
+    X(0x290, 0x2000, 0x01, 4, CAN_TYPE_I16, 0, sls.temp_power_100mdeg, -1, -1) \
+    X(0x290, 0x2000, 0x02, 4, CAN_TYPE_I16, 0, sls.temp_electronics_100mdeg, -1, -1) \
+    X(0x290, 0x2001, 0x01, 4, CAN_TYPE_I16, 0, sls.temp_motor_1_100mdeg, -1, -1) \
+    X(0x290, 0x2001, 0x02, 4, CAN_TYPE_I16, 0, sls.temp_motor_2_100mdeg, -1, -1) \
+    X(0x291, 0x2000, 0x01, 4, CAN_TYPE_U16, 0, foil_control.primary_input_position, -1, -1) \
+    X(0x291, 0x2001, 0x01, 4, CAN_TYPE_U16, 0, foil_control.primary_output_position, -1, -1) \
+    X(0x302, 0x2005, 0x01, 4, CAN_TYPE_U16, 0, mg_battery.voltage_mv, -1, -1) \
+    X(0x302, 0x2005, 0x02, 4, CAN_TYPE_I16, 0, mg_battery.current_10ma, 0, -1) \
+    X(0x302, 0x2005, 0x03, 4, CAN_TYPE_I16, 0, mg_battery.discharge_current_10ma, -1, -1) \
+    X(0x302, 0x2005, 0x04, 4, CAN_TYPE_I16, 0, mg_battery.charge_current_10ma, -1, -1) \
+    X(0x302, 0x2005, 0x05, 4, CAN_TYPE_U8, 0, mg_battery.soc, -1, -1) \
+    X(0x302, 0x2005, 0x06, 4, CAN_TYPE_U16, 0, mg_battery.time_to_go_min, -1, -1) \
+    X(0x390, 0x2000, 0x01, 4, CAN_TYPE_U16, 0, sls.uzk_10mv, -1, -1) \
+    X(0x390, 0x2001, 0x01, 4, CAN_TYPE_I16, 0, sls.motor_current_100ma, 1, 3) \
+    X(0x390, 0x2002, 0x01, 4, CAN_TYPE_I16, 0, sls.input_currect_100ma, 2, -1) \
+    X(0x390, 0x2003, 0x01, 4, CAN_TYPE_I16, 0, sls.rpm, 3, -1) \
+    X(0x402, 0x2005, 0x0E, 4, CAN_TYPE_U32, 0, mg_battery.bms_state, -1, 0) \
+    X(0x402, 0x2005, 0x0F, 4, CAN_TYPE_U8, 0, mg_battery.temp[0], -1, -1) \
+    X(0x402, 0x2005, 0x0F, 5, CAN_TYPE_U8, 0, mg_battery.temp[1], -1, -1) \
+    X(0x402, 0x2005, 0x0F, 6, CAN_TYPE_U8, 0, mg_battery.temp[2], -1, -1) \
+    X(0x402, 0x2005, 0x0F, 7, CAN_TYPE_U8, 0, mg_battery.temp[3], -1, -1) \
+    X(0x482, 0x2000, 0x01, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[0], -1, -1) \
+    X(0x482, 0x2000, 0x02, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[1], -1, -1) \
+    X(0x482, 0x2000, 0x03, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[2], -1, -1) \
+    X(0x482, 0x2000, 0x04, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[3], -1, -1) \
+    X(0x482, 0x2000, 0x05, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[4], -1, -1) \
+    X(0x482, 0x2000, 0x06, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[5], -1, -1) \
+    X(0x482, 0x2000, 0x07, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[6], -1, -1) \
+    X(0x482, 0x2000, 0x08, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[7], -1, -1) \
+    X(0x482, 0x2000, 0x09, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[8], -1, -1) \
+    X(0x482, 0x2000, 0x0A, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[9], -1, -1) \
+    X(0x482, 0x2000, 0x0B, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[10], -1, -1) \
+    X(0x482, 0x2000, 0x0C, 4, CAN_TYPE_U16, 0, mg_battery.cell_voltage_mv[11], -1, -1)
+
+// J1939 values sorted by PGN and source address, sub-index is always 0
+#define CAN_J1939_SIGNALS       0
+#define CAN_J1939_TABLE(X)
+
+// Log columns of the decoded values, X(name, type, scale, group, value, signal).
+// Signal is the position of the value in CAN_CANOPEN_TABLE followed by CAN_J1939_TABLE.
+#define CAN_COLUMN_TABLE(X) \
+    X("Batt voltage", LOG_TYPE_U16, -3, LOG_GROUP_BATTERY, mg_battery.voltage_mv, 49) \
+    X("Batt current", LOG_TYPE_I16, -2, LOG_GROUP_BATTERY, mg_battery.current_10ma, 50) \
+    X(" Batt discharge current", LOG_TYPE_I16, -2, LOG_GROUP_BATTERY, mg_battery.discharge_current_10ma, 51) \
+    X("Batt charge current", LOG_TYPE_I16, -2, LOG_GROUP_BATTERY, mg_battery.charge_current_10ma, 52) \
+    X("Batt soc", LOG_TYPE_U8, 0, LOG_GROUP_BATTERY, mg_battery.soc, 53) \
+    X("Batt time to go", LOG_TYPE_U16, 0, LOG_GROUP_BATTERY, mg_battery.time_to_go_min, 54) \
+    X("Batt bms state", LOG_TYPE_U32, 0, LOG_GROUP_BATTERY, mg_battery.bms_state, 59) \
+    X("Batt temp 0", LOG_TYPE_U8, 0, LOG_GROUP_CELLS, mg_battery.temp[0], 60) \
+    X("Batt temp 1", LOG_TYPE_U8, 0, LOG_GROUP_CELLS, mg_battery.temp[1], 61) \
+    X("Batt temp 2", LOG_TYPE_U8, 0, LOG_GROUP_CELLS, mg_battery.temp[2], 62) \
+    X("Batt temp 3", LOG_TYPE_U8, 0, LOG_GROUP_CELLS, mg_battery.temp[3], 63) \
+    X("Batt cell 1 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[0], 64) \
+    X("Batt cell 2 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[1], 65) \
+    X("Batt cell 3 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[2], 66) \
+    X("Batt cell 4 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[3], 67) \
+    X("Batt cell 5 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[4], 68) \
+    X("Batt cell 6 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[5], 69) \
+    X("Batt cell 7 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[6], 70) \
+    X("Batt cell 8 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[7], 71) \
+    X("Batt cell 9 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[8], 72) \
+    X("Batt cell 10 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[9], 73) \
+    X("Batt cell 11 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[10], 74) \
+    X("Batt cell 12 voltage", LOG_TYPE_U16, -3, LOG_GROUP_CELLS, mg_battery.cell_voltage_mv[11], 75) \
+    X("Power level", LOG_TYPE_U8, 0, LOG_GROUP_BATTERY, mg_battery.power_level, 22) \
+    X("MPPT 1 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[0].current_in_ma, 0) \
+    X("MPPT 1 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[0].voltage_in_mv, 1) \
+    X("MPPT 1 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[0].voltage_out_mv, 23) \
+    X("MPPT 1 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[0].power_in_100mw, 24) \
+    X("MPPT 2 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[1].current_in_ma, 2) \
+    X("MPPT 2 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[1].voltage_in_mv, 3) \
+    X("MPPT 2 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[1].voltage_out_mv, 25) \
+    X("MPPT 2 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[1].power_in_100mw, 26) \
+    X("MPPT 3 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[2].current_in_ma, 4) \
+    X("MPPT 3 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[2].voltage_in_mv, 5) \
+    X("MPPT 3 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[2].voltage_out_mv, 27) \
+    X("MPPT 3 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[2].power_in_100mw, 28) \
+    X("MPPT 4 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[3].current_in_ma, 6) \
+    X("MPPT 4 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[3].voltage_in_mv, 7) \
+    X("MPPT 4 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[3].voltage_out_mv, 29) \
+    X("MPPT 4 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[3].power_in_100mw, 30) \
+    X("MPPT 5 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[4].current_in_ma, 8) \
+    X("MPPT 5 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[4].voltage_in_mv, 9) \
+    X("MPPT 5 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[4].voltage_out_mv, 31) \
+    X("MPPT 5 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[4].power_in_100mw, 32) \
+    X("MPPT 6 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[5].current_in_ma, 10) \
+    X("MPPT 6 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[5].voltage_in_mv, 11) \
+    X("MPPT 6 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[5].voltage_out_mv, 33) \
+    X("MPPT 6 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[5].power_in_100mw, 34) \
+    X("MPPT 7 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[6].current_in_ma, 12) \
+    X("MPPT 7 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[6].voltage_in_mv, 13) \
+    X("MPPT 7 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[6].voltage_out_mv, 35) \
+    X("MPPT 7 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[6].power_in_100mw, 36) \
+    X("MPPT 8 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[7].current_in_ma, 14) \
+    X("MPPT 8 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[7].voltage_in_mv, 15) \
+    X("MPPT 8 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[7].voltage_out_mv, 37) \
+    X("MPPT 8 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[7].power_in_100mw, 38) \
+    X("MPPT 9 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[8].current_in_ma, 16) \
+    X("MPPT 9 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[8].voltage_in_mv, 17) \
+    X("MPPT 9 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[8].voltage_out_mv, 39) \
+    X("MPPT 9 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[8].power_in_100mw, 40) \
+    X("MPPT 10 A in", LOG_TYPE_I16, -3, LOG_GROUP_MPPT, mg_mppt[9].current_in_ma, 18) \
+    X("MPPT 10 V in", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[9].voltage_in_mv, 19) \
+    X("MPPT 10 V out", LOG_TYPE_U16, -3, LOG_GROUP_MPPT, mg_mppt[9].voltage_out_mv, 41) \
+    X("MPPT 10 P in", LOG_TYPE_I16, -1, LOG_GROUP_MPPT, mg_mppt[9].power_in_100mw, 42) \
+    X("SLS status", LOG_TYPE_U32, 0, LOG_GROUP_SLS, sls.status, 20) \
+    X("SLS limiting", LOG_TYPE_U32, 0, LOG_GROUP_SLS, sls.limiting, 21) \
+    X("SLS temp power", LOG_TYPE_I16, -1, LOG_GROUP_SLS, sls.temp_power_100mdeg, 43) \
+    X("SLS temp elec", LOG_TYPE_I16, -1, LOG_GROUP_SLS, sls.temp_electronics_100mdeg, 44) \
+    X("SLS temp motor 1", LOG_TYPE_I16, -1, LOG_GROUP_SLS, sls.temp_motor_1_100mdeg, 45) \
+    X("SLS temp motor 2", LOG_TYPE_I16, -1, LOG_GROUP_SLS, sls.temp_motor_2_100mdeg, 46) \
+    X("SLS UZK", LOG_TYPE_U16, -2, LOG_GROUP_SLS, sls.uzk_10mv, 55) \
+    X("SLS motor current", LOG_TYPE_I16, -1, LOG_GROUP_SLS, sls.motor_current_100ma, 56) \
+    X("SLS input current", LOG_TYPE_I16, -1, LOG_GROUP_SLS, sls.input_currect_100ma, 57) \
+    X("RPM", LOG_TYPE_I16, 0, LOG_GROUP_SLS, sls.rpm, 58) \
+    X("Foil input 1 pos", LOG_TYPE_U16, 0, LOG_GROUP_FOIL, foil_control.primary_input_position, 47) \
+    X("Foil output 1 pos", LOG_TYPE_U16, 0, LOG_GROUP_FOIL, foil_control.primary_output_position, 48)
+
+// Values with a running min, max and mean, X(aggregate, group)
+#define CAN_AGGREGATES  4
+#define CAN_AGGREGATE_TABLE(X) \
+    X(0, LOG_GROUP_BATTERY) \
+    X(1, LOG_GROUP_SLS) \
+    X(2, LOG_GROUP_SLS) \
+    X(3, LOG_GROUP_SLS)
+
+// Log columns of the aggregates, X(name, type, scale, group, aggregate, statistic).
+// Statistic is the field of can_bus_aggregate_t.
+#define CAN_AGGREGATE_COLUMN_TABLE(X) \
+    X("Batt current min", LOG_TYPE_I16, -2, LOG_GROUP_BATTERY, 0, min) \
+    X("Batt current max", LOG_TYPE_I16, -2, LOG_GROUP_BATTERY, 0, max) \
+    X("Batt current mean", LOG_TYPE_I16, -2, LOG_GROUP_BATTERY, 0, mean) \
+    X("SLS motor current min", LOG_TYPE_I16, -1, LOG_GROUP_SLS, 1, min) \
+    X("SLS motor current max", LOG_TYPE_I16, -1, LOG_GROUP_SLS, 1, max) \
+    X("SLS motor current mean", LOG_TYPE_I16, -1, LOG_GROUP_SLS, 1, mean) \
+    X("SLS input current min", LOG_TYPE_I16, -1, LOG_GROUP_SLS, 2, min) \
+    X("SLS input current max", LOG_TYPE_I16, -1, LOG_GROUP_SLS, 2, max) \
+    X("SLS input current mean", LOG_TYPE_I16, -1, LOG_GROUP_SLS, 2, mean) \
+    X("RPM min", LOG_TYPE_I16, 0, LOG_GROUP_SLS, 3, min) \
+    X("RPM max", LOG_TYPE_I16, 0, LOG_GROUP_SLS, 3, max) \
+    X("RPM mean", LOG_TYPE_I16, 0, LOG_GROUP_SLS, 3, mean)
+
+// Values that start a raw capture window, X(trigger, kind, step). Kind is CAN_TRIGGER_*
+// from canbus.h, step the change that fires a CAN_TRIGGER_STEP trigger.
+#define CAN_TRIGGERS    4
+#define CAN_TRIGGER_TABLE(X) \
+    X(0, CAN_TRIGGER_CHANGE, 0) \
+    X(1, CAN_TRIGGER_SET, 0) \
+    X(2, CAN_TRIGGER_SET, 0) \
+    X(3, CAN_TRIGGER_STEP, 200)
+
+#endif	/* CAN_SIGNALS_H */
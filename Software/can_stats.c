@@ -0,0 +1,224 @@
+/*
+ * File:   can_stats.c
+ *
+ * Statistics of the CAN bus. The receive path counts every frame in a small
+ * table of ids and adds its length in bits for the bus load. The ECAN error
+ * interrupt counts the changes of the error state. Every CAN_STATS_PERIOD_MS
+ * the counts are turned into rates and the error counters are taken.
+ */
+
+#include <xc.h>
+#include <stdint.h>
+#include "can_stats.h"
+#include "can_capture.h"
+#include "canbus.h"
+#include "debugprint.h"
+#include "softwaretimer.h"
+
+// Bits of a data frame without data and stuff bits, with the interframe space
+#define CAN_STATS_STANDARD_BITS     47
+#define CAN_STATS_EXTENDED_BITS     67
+
+static can_stats_id_t can_stats_ids[CAN_STATS_IDS];
+static uint8_t can_stats_id_count = 0;
+static uint32_t can_stats_frames = 0;       // Counts of the current period
+static uint32_t can_stats_other = 0;
+static uint32_t can_stats_bits = 0;
+static uint32_t can_stats_start = 0;        // Start time of the current period
+static uint8_t can_stats_tec = 0;
+static uint8_t can_stats_rec = 0;
+static can_stats_t can_stats = {};
+
+// Written by the interrupt
+static volatile uint8_t can_stats_state = CAN_STATS_STATE_ACTIVE;
+static volatile uint16_t can_stats_entered[4] = {};    // Times each state was entered
+static volatile uint16_t can_stats_invalid = 0;
+
+// Returns the error state shown by the ECAN flags
+static uint8_t can_stats_read_state(void) {
+    if (C1INTFbits.TXBO) {
+        return CAN_STATS_STATE_BUS_OFF;
+    }
+    if (C1INTFbits.TXBP || C1INTFbits.RXBP) {
+        return CAN_STATS_STATE_PASSIVE;
+    }
+    if (C1INTFbits.EWARN) {
+        return CAN_STATS_STATE_WARNING;
+    }
+    return CAN_STATS_STATE_ACTIVE;
+}
+
+// Frames per second from a count over elapsed ms
+static uint16_t can_stats_rate(uint32_t count, uint32_t elapsed) {
+    count = count * 1000 / elapsed;
+    return count > 0xFFFF ? 0xFFFF : count;
+}
+
+// Turns the counts into the rates of the period that ended at the given time
+static void can_stats_end_period(uint32_t end) {
+    uint32_t elapsed = end - can_stats_start;
+    can_bus_rx_stats_t rx_stats;
+    uint16_t error_count = C1EC;
+    uint8_t i, kept;
+    
+    // Ids that were quiet for a whole period make room for new ones
+    kept = 0;
+    for (i = 0; i < can_stats_id_count; i++) {
+        if (can_stats_ids[i].count != 0) {
+            can_stats_ids[kept].id = can_stats_ids[i].id;
+            can_stats_ids[kept].rate = can_stats_rate(can_stats_ids[i].count, elapsed);
+            can_stats_ids[kept].count = 0;
+            kept++;
+        }
+    }
+    can_stats_id_count = kept;
+    
+    can_stats.frame_rate = can_stats_rate(can_stats_frames, elapsed);
+    can_stats.other_rate = can_stats_rate(can_stats_other, elapsed);
+    can_stats.bus_load = (uint64_t)can_stats_bits * 1000 * 1000 / ((uint64_t)CAN_STATS_BITRATE * elapsed);
+    can_stats.ids = kept;
+    can_stats.state = can_stats_state;
+    can_stats.tec = can_stats_tec;
+    can_stats.rec = can_stats_rec;
+    // The interrupt counters are 16 bit and each one is read in one instruction
+    can_stats.invalid_frames = can_stats_invalid;
+    can_stats.warnings = can_stats_entered[CAN_STATS_STATE_WARNING];
+    can_stats.passives = can_stats_entered[CAN_STATS_STATE_PASSIVE];
+    can_stats.bus_offs = can_stats_entered[CAN_STATS_STATE_BUS_OFF];
+    rx_stats = get_can_bus_rx_stats();
+    can_stats.ring_overflows = rx_stats.ring_overflows;
+    can_stats.hardware_overflows = rx_stats.hardware_overflows;
+    
+    can_stats_frames = 0;
+    can_stats_other = 0;
+    can_stats_bits = 0;
+    can_stats_tec = error_count >> 8;
+    can_stats_rec = error_count & 0xFF;
+    can_stats_start = end;
+}
+
+void can_stats_add(const uCAN_MSG *msg, uint32_t timestamp_ms) {
+    uint32_t id = msg->frame.id;
+    uint8_t i;
+    
+    // Frames are decoded late after a stall. A frame received after the end of
+    // the period ends it, so the frames count in the period they were received in.
+    if ((int32_t)(timestamp_ms - can_stats_start) >= CAN_STATS_PERIOD_MS) {
+        can_stats_end_period(timestamp_ms);
+    }
+    
+    can_stats_frames++;
+    if (msg->frame.idType == CAN_FRAME_EXT) {
+        id |= CAN_CAPTURE_ID_EXTENDED;
+        can_stats_bits += CAN_STATS_EXTENDED_BITS;
+    } else {
+        can_stats_bits += CAN_STATS_STANDARD_BITS;
+    }
+    if (msg->frame.msgtype != CAN_MSG_RTR) {
+        can_stats_bits += 8 * (msg->frame.dlc < 8 ? msg->frame.dlc : 8);
+    }
+    
+    for (i = 0; i < can_stats_id_count && can_stats_ids[i].id != id; i++);
+    if (i == can_stats_id_count) {
+        if (can_stats_id_count == CAN_STATS_IDS) {
+            can_stats_other++;
+            return;
+        }
+        can_stats_ids[i].id = id;
+        can_stats_ids[i].rate = 0;
+        can_stats_ids[i].count = 0;
+        can_stats_id_count++;
+    }
+    if (can_stats_ids[i].count != 0xFFFF) {
+        can_stats_ids[i].count++;
+    }
+}
+
+void can_stats_error_interrupt(void) {
+    uint8_t state;
+    
+    if (C1INTFbits.IVRIF) {
+        can_stats_invalid++;
+        C1INTFbits.IVRIF = 0;
+    }
+    if (C1INTFbits.ERRIF) {
+        C1INTFbits.ERRIF = 0;
+        // Count every state passed on the way up
+        state = can_stats_read_state();
+        while (can_stats_state < state) {
+            can_stats_state++;
+            can_stats_entered[can_stats_state]++;
+        }
+    }
+}
+
+void can_stats_process(void) {
+    uint32_t now = softwaretimer_get_ms();
+    uint16_t error_count = C1EC;
+    
+    // The interrupt only sees the way up, follow the way back here
+    if (can_stats_read_state() < can_stats_state) {
+        IEC2bits.C1IE = 0;
+        if (can_stats_read_state() < can_stats_state) {
+            can_stats_state = can_stats_read_state();
+        }
+        IEC2bits.C1IE = 1;
+    }
+    
+    // Keep the highest error counters of the period
+    if ((error_count >> 8) > can_stats_tec) {
+        can_stats_tec = error_count >> 8;
+    }
+    if ((error_count & 0xFF) > can_stats_rec) {
+        can_stats_rec = error_count & 0xFF;
+    }
+    
+    if ((int32_t)(now - can_stats_start) >= CAN_STATS_PERIOD_MS) {
+        can_stats_end_period(now);
+    }
+}
+
+void can_stats_get(can_stats_t *stats) {
+    *stats = can_stats;
+}
+
+void can_stats_print(void) {
+    uint8_t i;
+    
+    debugprint_string("CAN filtered ");
+    debugprint_uint(can_stats.frame_rate);
+    debugprint_string(" frames/s, load ");
+    debugprint_uint(can_stats.bus_load / 10);
+    debugprint_char('.');
+    debugprint_uint(can_stats.bus_load % 10);
+    debugprint_string("%, state ");
+    debugprint_uint(can_stats.state);
+    debugprint_string(", TEC ");
+    debugprint_uint(can_stats.tec);
+    debugprint_string(", REC ");
+    debugprint_uint(can_stats.rec);
+    debugprint_string("\r\nInvalid ");
+    debugprint_uint(can_stats.invalid_frames);
+    debugprint_string(", warning ");
+    debugprint_uint(can_stats.warnings);
+    debugprint_string(", passive ");
+    debugprint_uint(can_stats.passives);
+    debugprint_string(", bus off ");
+    debugprint_uint(can_stats.bus_offs);
+    debugprint_string(", ring overflows ");
+    debugprint_uint(can_stats.ring_overflows);
+    debugprint_string(", ECAN overflows ");
+    debugprint_uint(can_stats.hardware_overflows);
+    debugprint_string("\r\n");
+    
+    for (i = 0; i < can_stats_id_count; i++) {
+        debugprint_string("  ");
+        debugprint_hex(can_stats_ids[i].id);
+        debugprint_string(" ");
+        debugprint_uint(can_stats_ids[i].rate);
+        debugprint_string("/s\r\n");
+    }
+    debugprint_string("  other ");
+    debugprint_uint(can_stats.other_rate);
+    debugprint_string("/s\r\n");
+}
@@ -0,0 +1,79 @@
+/*
+ * File:                can_stats.h
+ * Comments:            Statistics of the CAN bus. Counts the received frames per
+ *                      id, estimates the bus load and follows the error state of
+ *                      the ECAN module, so a quiet bus can be told apart from a
+ *                      logger that loses frames.
+ */
+
+// This is a guard condition so that contents of this file are not included
+// more than once.
+#ifndef CAN_STATS_H
+#define	CAN_STATS_H
+
+#include <stdint.h>
+#include "mcc_generated_files/can_types.h"
+
+// Ids with their own frame counter. Frames of more ids are counted as other.
+#define CAN_STATS_IDS               32
+
+// Bit rate of the bus as set up for ECAN1 in MCC
+#define CAN_STATS_BITRATE           250000UL
+
+// Rates, bus load and error counters are taken over this period
+#define CAN_STATS_PERIOD_MS         1000
+
+// Error states of the ECAN module
+#define CAN_STATS_STATE_ACTIVE      0
+#define CAN_STATS_STATE_WARNING     1       // An error counter reached 96
+#define CAN_STATS_STATE_PASSIVE     2       // An error counter reached 128
+#define CAN_STATS_STATE_BUS_OFF     3       // The transmit error counter passed 255
+
+// Frame rate of one id
+typedef struct {
+    uint32_t id;                    // CAN id, CAN_CAPTURE_ID_EXTENDED set for extended ids
+    uint16_t rate;                  // Frames per second in the last period
+    uint16_t count;                 // Frames so far in this period
+}can_stats_id_t;
+
+// Statistics of the last period. The event counters count since boot.
+// Only the frames passed by the acceptance filters are received, so the rates, the
+// load and the ids cover the whole bus only when the filters are open (CAN_CAPTURE_ALL).
+typedef struct {
+    uint16_t frame_rate;            // Received frames per second
+    uint16_t other_rate;            // Frames per second of ids that did not fit in the id table
+    uint16_t bus_load;              // Estimated load of the received frames in 0.1 %, without stuff bits
+    uint8_t ids;                    // Ids that sent frames
+    uint8_t state;                  // CAN_STATS_STATE_* at the end of the period
+    uint8_t tec;                    // Highest transmit error counter in the period
+    uint8_t rec;                    // Highest receive error counter in the period
+    uint16_t invalid_frames;        // Frames received with an error
+    uint16_t warnings;              // Times the error warning state was entered
+    uint16_t passives;              // Times the error passive state was entered
+    uint16_t bus_offs;              // Times the bus off state was entered
+    uint16_t ring_overflows;        // From can_bus_rx_stats_t
+    uint16_t hardware_overflows;
+}can_stats_t;
+
+// Counts a received frame. Called by the receive path for every frame.
+// Parameters:
+//  *msg            The received frame
+//  timestamp_ms    The time the frame was received, softwaretimer_get_ms()
+void can_stats_add(const uCAN_MSG *msg, uint32_t timestamp_ms);
+
+// Follows the error state of the ECAN module. Called from the ECAN interrupt
+// for the error and invalid message interrupts.
+void can_stats_error_interrupt(void);
+
+// Ends a period every CAN_STATS_PERIOD_MS. Needs to be called in the main loop.
+void can_stats_process(void);
+
+// Returns the statistics of the last period
+// Parameters:
+//  *stats          Filled with the statistics
+void can_stats_get(can_stats_t *stats);
+
+// Prints the statistics and the rate of each id on the debug uart
+void can_stats_print(void);
+
+#endif	/* CAN_STATS_H */
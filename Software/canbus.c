@@ -6,192 +6,822 @@
  */
 
 
+#include <xc.h>
 #include "canbus.h"
 #include "mcc_generated_files/can1.h"
 #include "mcc_generated_files/can_types.h"
+#include <string.h>
 #include "softwaretimer.h"
 #include "debugprint.h"
+#include "can_capture.h"
+#include "can_stats.h"
+#include "utl.h"
 
-static mg_battery_t mg_battery = {};
-static mg_mppt_t mg_mppt[NODE_ID_MG_MPPT_TOTAL] = {};
-static sls_t sls = {};
-static foil_control_t foil_control = {};
-
-static void can_bus_receive_messages(void) {
-    uCAN_MSG rx_msg;
-    uint16_t cob_id, index, function_code;
-    uint8_t sub_index, node_id;
-    union {
-        uint32_t uint32;
-        double double32;
-    }double_uint32_conversion;
-    
-    if (CAN1_messagesInBuffer() > 0){
-        CAN1_receive(&rx_msg);
-                
-        // Debug data
-        /*
-        debugprint_string("R can ");
-        debugprint_hex(rx_msg.frame.id);
-        debugprint_string(" ");
-        debugprint_hex(rx_msg.frame.dlc);
-        debugprint_string("  ");
-        debugprint_hex(rx_msg.frame.data0);
-        debugprint_string(" ");
-        debugprint_hex(rx_msg.frame.data1);
-        debugprint_string(" ");
-        debugprint_hex(rx_msg.frame.data2);
-        debugprint_string(" ");
-        debugprint_hex(rx_msg.frame.data3);
-        debugprint_string("  ");
-        debugprint_hex(rx_msg.frame.data4);
-        debugprint_string(" ");
-        debugprint_hex(rx_msg.frame.data5);
-        debugprint_string(" ");
-        debugprint_hex(rx_msg.frame.data6);
-        debugprint_string(" ");
-        debugprint_hex(rx_msg.frame.data7);
-        debugprint_string("\r\n");
-        */
-        
-        cob_id = rx_msg.frame.id;
-        function_code = cob_id & ~0x007F;
-        node_id = cob_id & 0x7F;
-        index = rx_msg.frame.data2 << 8 | rx_msg.frame.data1;
-        sub_index = rx_msg.frame.data3;
-        
-        debugprint_string("CAN\r\n");
-        
-        // MG battery
-        if (node_id == NODE_ID_MG_BATTERY && function_code == 0x200) {
-            // Power level
-            mg_battery.power_level = rx_msg.frame.data0;
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x300 && index == 0x2005 && sub_index == 0x01) {
-            // Battery voltage
-            mg_battery.voltage_mv = (uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x300 && index == 0x2005 && sub_index == 0x02) {
-            // Battery current
-            mg_battery.current_10ma = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x300 && index == 0x2005 && sub_index == 0x03) {
-            // discharge current
-            mg_battery.discharge_current_10ma = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x300 && index == 0x2005 && sub_index == 0x04) {
-            // charge current
-            mg_battery.charge_current_10ma = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x300 && index == 0x2005 && sub_index == 0x05) {
-            // soc
-            mg_battery.soc = rx_msg.frame.data4;
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x300 && index == 0x2005 && sub_index == 0x06) {
-            // time to go
-            mg_battery.time_to_go_min = (uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x400 && index == 0x2005 && sub_index == 0x0E) {
-            // BMS state
-            mg_battery.bms_state = (uint32_t)rx_msg.frame.data7 << 24 | (uint32_t)rx_msg.frame.data6 << 16 | (uint32_t)rx_msg.frame.data5 << 8 | (uint32_t)rx_msg.frame.data4;
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x400 && index == 0x2005 && sub_index == 0x0F) {
-            // Temperature
-            mg_battery.temp[0] = rx_msg.frame.data4;
-            mg_battery.temp[1] = rx_msg.frame.data5;
-            mg_battery.temp[2] = rx_msg.frame.data6;
-            mg_battery.temp[3] = rx_msg.frame.data7;
-        }
-        else if (node_id == NODE_ID_MG_BATTERY && function_code == 0x480 && index == 0x2000) {
-            if (1 <= sub_index && sub_index <= 12) {
-                mg_battery.cell_voltage_mv[sub_index-1] = (uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
-            }
+#define CAN_DATA_NONE   0xFF
+
+// Two copies of the decoded values, see can_bus_acquire_data(). The decoder
+// writes each value into both, except into the copy the reader holds. The values
+// a held copy missed are copied over from the other one after it is released.
+static can_data_t can_data[2] = {};
+static volatile uint8_t can_data_held = CAN_DATA_NONE;     // Written by the reader
+static uint8_t can_data_behind = CAN_DATA_NONE;             // Copy that missed values
+
+// A received frame with the time the interrupt took it from the ECAN buffer
+typedef struct {
+    uCAN_MSG msg;
+    uint32_t timestamp_ms;
+} can_bus_rx_frame_t;
+
+// Frames received in the interrupt. The interrupt is the only producer,
+// can_bus_process() the only consumer.
+static can_bus_rx_frame_t can_bus_rx_ring[CAN_BUS_RX_RING_SIZE];
+static volatile uint8_t can_bus_rx_head = 0;        // Written by the interrupt
+static volatile uint8_t can_bus_rx_tail = 0;        // Written by can_bus_process()
+static volatile can_bus_rx_stats_t can_bus_rx_stats = {};
+
+// Value types. The lower nibble is the size in bytes of the target field.
+// Bit 7 is set for signed values. Bit 6 is set when the frame holds a 4 byte
+// float, which is scaled and stored in the target field.
+#define CAN_TYPE_U8         0x01
+#define CAN_TYPE_U16        0x02
+#define CAN_TYPE_U32        0x04
+#define CAN_TYPE_I16        0x82
+#define CAN_TYPE_FLOAT_U16  0x42
+#define CAN_TYPE_FLOAT_I16  0xC2
+
+#define CAN_TYPE_SIZE(type)         ((type) & 0x0F)
+#define CAN_TYPE_IS_SIGNED(type)    (((type) & 0x80) != 0)
+#define CAN_TYPE_IS_FLOAT(type)     (((type) & 0x40) != 0)
+
+// A value in a received frame. Frames with a CANopen multiplexer (index and
+// sub-index in bytes 1 to 3) are found by COB-ID, index and sub-index.
+// Entries with index 0 take the frame of the COB-ID without looking at a multiplexer.
+// J1939 messages are found by PGN and source address, with sub-index 0.
+typedef struct {
+    uint32_t id;            // CANopen COB-ID or J1939 PGN
+    uint16_t index;         // CANopen index or J1939 source address
+    uint8_t sub_index;
+    uint8_t offset;         // First data byte of the value, little endian
+    uint8_t type;           // CAN_TYPE_*
+    int8_t scale;           // Float values are multiplied by 10^scale
+    int8_t aggregate;       // Position in can_aggregates, -1 when the value is not aggregated
+    int8_t trigger;         // Position in can_triggers, -1 when the value has no trigger
+    void *target;
+} can_signal_t;
+
+#define CAN_SIGNAL(id, index, sub_index, offset, type, scale, target, aggregate, trigger) \
+    {id, index, sub_index, offset, type, scale, aggregate, trigger, &can_data[0].target},
+
+// The CANopen values followed by the J1939 values, each part sorted by its key
+// for the binary search, see can_signals.h. A frame with more than one value
+// has an entry per value, in a row.
+static const can_signal_t can_signals[] = {
+    CAN_CANOPEN_TABLE(CAN_SIGNAL)
+    CAN_J1939_TABLE(CAN_SIGNAL)
+};
+
+#define CAN_SIGNALS     (sizeof(can_signals) / sizeof(can_signals[0]))
+
+// Time in ms each signal was last received, 0 if it never was
+static uint32_t can_signal_time[CAN_SIGNALS] = {};
+
+// A bit for each signal that can_data_behind missed
+static uint8_t can_data_missed[(CAN_SIGNALS + 7) / 8] = {};
+
+// Running min, max and sum of the aggregated values since can_bus_take_aggregate()
+typedef struct {
+    int32_t min;
+    int32_t max;
+    int32_t sum;
+    uint16_t count;
+} can_aggregate_t;
+
+static can_aggregate_t can_aggregates[CAN_AGGREGATES] = {};
+
+// Values that open a raw capture window, see CAN_TRIGGER_TABLE
+typedef struct {
+    uint8_t kind;           // CAN_TRIGGER_*
+    int32_t step;           // Change that fires a CAN_TRIGGER_STEP trigger
+} can_trigger_t;
+
+#define CAN_TRIGGER(trigger, kind, step)    {kind, step},
+
+static const can_trigger_t can_triggers[] = {
+    CAN_TRIGGER_TABLE(CAN_TRIGGER)
+};
+
+// The previous value of each trigger
+static int32_t can_trigger_values[CAN_TRIGGERS];
+static uint8_t can_trigger_received[CAN_TRIGGERS] = {};
+
+// CANopen nodes, found from their heartbeat or from frames of the CANopen table.
+// The node of a COB-ID is in its lowest 7 bits, node 0 is for broadcasts like SYNC.
+#define CAN_COB_ID_HEARTBEAT        0x700   // Boot-up and heartbeat, byte 0 is the NMT state
+#define CAN_COB_ID_NODE_MASK        0x7F
+#define CAN_NODE_IS_SET(bits, node) (((bits)[(node) / 8] & (1 << ((node) % 8))) != 0)
+#define CAN_FILTER_ID_END           0xFFFF
+
+typedef struct {
+    uint8_t node;
+    uint8_t state;          // NMT state of the last heartbeat, CAN_BUS_NMT_UNKNOWN before the first
+} can_node_t;
+
+// Taken in the order the nodes are found
+static can_node_t can_nodes[CAN_BUS_NODES];
+static uint8_t can_node_count = 0;
+static uint32_t can_node_found_ms = 0;      // Time the last node was found, or of can_bus_init()
+static uint8_t can_table_nodes[16] = {};    // A bit for each node with COB-IDs in the CANopen table
+static uint8_t can_found_nodes[16] = {};    // A bit for each node in can_nodes
+
+// J1939 addresses, PGNs and transport protocol
+#define CAN_J1939_ANY_SOURCE        0xFF    // Source address of table entries that take any source
+#define CAN_J1939_GLOBAL            0xFF    // Destination of broadcast messages
+#define CAN_J1939_PDU2              240     // PDU formats from here are broadcast PGNs without destination
+#define CAN_J1939_PGN_TP_CM         0xEC00UL
+#define CAN_J1939_PGN_TP_DT         0xEB00UL
+#define CAN_J1939_TP_RTS            16      // TP.CM control bytes
+#define CAN_J1939_TP_BAM            32
+#define CAN_J1939_TP_ABORT          255
+#define CAN_J1939_TP_PACKET_SIZE    7
+#define CAN_J1939_TP_TIMEOUT_MS     750     // T1, the longest time between two packets
+
+#if CAN_BUS_J1939_MAX_SIZE > 15 * CAN_J1939_TP_PACKET_SIZE
+#error "The packets of a J1939 transfer are counted in 15 bits"
+#endif
+
+// A J1939 message that is being put together from transport protocol packets
+typedef struct {
+    uint32_t pgn;
+    uint32_t time;                  // Time of the last packet
+    uint16_t size;
+    uint16_t received;              // Bit n is set when packet n + 1 was received
+    uint8_t source;
+    uint8_t destination;            // CAN_J1939_GLOBAL for a BAM transfer
+    uint8_t packets;                // 0 when the session is free
+    uint8_t data[CAN_BUS_J1939_MAX_SIZE];
+} can_j1939_session_t;
+
+static can_j1939_session_t can_j1939_sessions[CAN_BUS_J1939_SESSIONS] = {};
+
+// ECAN acceptance filters. Filters 0 to 13 pass the COB-IDs of the CANopen
+// table and the heartbeats of its nodes. Filter 14 passes every extended frame when there are J1939 values or
+// all frames are captured, filter 15 every standard frame while all frames are captured.
+#define CAN_FILTERS             14
+#define CAN_FILTER_EXTENDED     14
+#define CAN_FILTER_STANDARD     15
+#define CAN_MASK_EXACT          0       // Compares all 11 bits
+#define CAN_MASK_GROUP          1       // Compares the upper bits, set in can_bus_init_filters()
+#define CAN_MASK_TYPE           2       // Only compares the frame type
+#define CAN_MASK_MIDE           0x0008  // Only frames of the type set in the filter
+#define CAN_FILTER_EXIDE        0x0008  // The filter is for extended frames
+#define CAN_OPMODE_CONFIG       4
+
+// Compares the key of a signal with the given key, like strcmp
+static int8_t can_bus_compare_signal(const can_signal_t *signal, uint32_t id, uint16_t index, uint8_t sub_index) {
+    if (signal->id != id) {
+        return signal->id < id ? -1 : 1;
+    }
+    if (signal->index != index) {
+        return signal->index < index ? -1 : 1;
+    }
+    if (signal->sub_index != sub_index) {
+        return signal->sub_index < sub_index ? -1 : 1;
+    }
+    return 0;
+}
+
+// Returns the index of the first signal with the key between first and last,
+// last when there is none
+static uint8_t can_bus_find_signal(uint8_t first, uint8_t last, uint32_t id, uint16_t index, uint8_t sub_index) {
+    uint8_t low = first, high = last, middle;
+    
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (can_bus_compare_signal(&can_signals[middle], id, index, sub_index) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
-        
-        // MG MPPT
-        else if (NODE_ID_MG_MPPT <= node_id && node_id <= (NODE_ID_MG_MPPT + NODE_ID_MG_MPPT_TOTAL) && function_code == 0x180) {
-            // Current in
-            double_uint32_conversion.uint32 = (uint32_t)rx_msg.frame.data3 << 24 | (uint32_t)rx_msg.frame.data2 << 16 | (uint32_t)rx_msg.frame.data1 << 8 | (uint16_t)rx_msg.frame.data0;
-            mg_mppt[node_id - 0x04].current_in_ma = double_uint32_conversion.double32;
-            // voltage in
-            double_uint32_conversion.uint32 = (uint32_t)rx_msg.frame.data7 << 24 | (uint32_t)rx_msg.frame.data6 << 16 | (uint32_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
-            mg_mppt[node_id - 0x04].voltage_in_mv = double_uint32_conversion.double32 * 1000;
-        }
-        else if (NODE_ID_MG_MPPT <= node_id && node_id <= (NODE_ID_MG_MPPT + NODE_ID_MG_MPPT_TOTAL) && function_code == 0x280) {
-            // voltage out
-            double_uint32_conversion.uint32 = (uint32_t)rx_msg.frame.data3 << 24 | (uint32_t)rx_msg.frame.data2 << 16 | (uint32_t)rx_msg.frame.data1 << 8 | (uint16_t)rx_msg.frame.data0;
-            mg_mppt[node_id - 0x04].voltage_out_mv = double_uint32_conversion.double32 * 1000;
-            // power in
-            double_uint32_conversion.uint32 = (uint32_t)rx_msg.frame.data7 << 24 | (uint32_t)rx_msg.frame.data6 << 16 | (uint32_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
-            mg_mppt[node_id - 0x04].power_in_100mw = double_uint32_conversion.double32 / 100;
+    }
+    if (low < last && can_bus_compare_signal(&can_signals[low], id, index, sub_index) == 0) {
+        return low;
+    }
+    return last;
+}
+
+// Programs one acceptance filter for frames with the given standard id.
+// The ECAN module needs to be in configuration mode with the filter window selected.
+static void can_bus_set_filter(uint8_t filter, uint16_t sid, uint8_t extended, uint8_t mask, uint8_t buffer) {
+    volatile uint16_t *mask_select = &C1FMSKSEL1 + filter / 8;
+    volatile uint16_t *buffer_pointer = &C1BUFPNT1 + filter / 4;
+    uint8_t shift;
+    
+    // The SID and EID registers of all filters follow each other
+    (&C1RXF0SID)[filter * 2] = sid << 5 | (extended ? CAN_FILTER_EXIDE : 0);
+    (&C1RXF0SID)[filter * 2 + 1] = 0;
+    
+    shift = (filter % 8) * 2;
+    *mask_select = (*mask_select & ~(0x0003U << shift)) | (uint16_t)mask << shift;
+    shift = (filter % 4) * 4;
+    *buffer_pointer = (*buffer_pointer & ~(0x000FU << shift)) | (uint16_t)buffer << shift;
+}
+
+// Returns the COB-IDs the filters pass one by one: the ids of the CANopen table
+// in its sorted order, then the heartbeats of its nodes. CAN_FILTER_ID_END after the last.
+// Parameters:
+//  *position       0 for the first id, moved on by each call
+static uint16_t can_bus_next_filter_id(uint16_t *position) {
+    uint8_t node;
+    
+    if (*position < CAN_CANOPEN_SIGNALS) {
+        return can_signals[(*position)++].id;
+    }
+    for (node = *position - CAN_CANOPEN_SIGNALS; node <= CAN_COB_ID_NODE_MASK; node++) {
+        if (CAN_NODE_IS_SET(can_table_nodes, node)) {
+            *position = CAN_CANOPEN_SIGNALS + node + 1;
+            return CAN_COB_ID_HEARTBEAT + node;
         }
-        
-        // SLS motor controller
-        else if (node_id == NODE_ID_SLS && function_code == 0x180 && index == 0x2000 && sub_index == 0x01) {
-            // status
-            sls.status = (uint32_t)rx_msg.frame.data7 << 24 | (uint32_t)rx_msg.frame.data6 << 16 | (uint32_t)rx_msg.frame.data5 << 8 | (uint32_t)rx_msg.frame.data4;
+    }
+    *position = CAN_CANOPEN_SIGNALS + CAN_COB_ID_NODE_MASK + 1;
+    return CAN_FILTER_ID_END;
+}
+
+// Groups the COB-IDs to pass that only differ in the lowest bits.
+// A group with one COB-ID gets a filter on the exact id, a group with more a
+// filter on the upper bits. The filters are programmed when program is set.
+// Returns the number of filters needed, accepted is set to the number of ids they pass.
+static uint8_t can_bus_group_filters(uint8_t bits, uint8_t program, uint8_t buffer, uint16_t *accepted) {
+    uint16_t position = 0, id, first, previous;
+    uint8_t filter = 0, ids;
+    
+    *accepted = 0;
+    id = can_bus_next_filter_id(&position);
+    while (id != CAN_FILTER_ID_END) {
+        first = id;
+        previous = CAN_FILTER_ID_END;
+        ids = 0;
+        // The ids come sorted, so a group is a run of them
+        while (id != CAN_FILTER_ID_END && (id >> bits) == (first >> bits)) {
+            if (id != previous) {
+                ids++;
+            }
+            previous = id;
+            id = can_bus_next_filter_id(&position);
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x180 && index == 0x2001 && sub_index == 0x01) {
-            // output limiting
-            sls.limiting = (uint32_t)rx_msg.frame.data7 << 24 | (uint32_t)rx_msg.frame.data6 << 16 | (uint32_t)rx_msg.frame.data5 << 8 | (uint32_t)rx_msg.frame.data4;
+        
+        if (program && filter < CAN_FILTERS) {
+            if (ids == 1) {
+                can_bus_set_filter(filter, first, 0, CAN_MASK_EXACT, buffer);
+            } else {
+                can_bus_set_filter(filter, first >> bits << bits, 0, CAN_MASK_GROUP, buffer);
+            }
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x280 && index == 0x2000 && sub_index == 0x01) {
-            // power temperature
-            sls.temp_power_100mdeg = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
+        *accepted += (ids == 1) ? 1 : (uint16_t)1 << bits;
+        filter++;
+    }
+    return filter;
+}
+
+// Sets up the acceptance filters so only frames with decoded signals and the
+// heartbeats of their nodes reach the software.
+// The group size is chosen that passes the fewest ids with the filters available.
+static void can_bus_init_filters(void) {
+    uint8_t bits, best_bits = 11, mode, buffer, filters;
+    uint16_t accepted, best_accepted = 0xFFFF;
+    
+    for (bits = 1; bits <= 11; bits++) {
+        if (can_bus_group_filters(bits, 0, 0, &accepted) <= CAN_FILTERS && accepted < best_accepted) {
+            best_bits = bits;
+            best_accepted = accepted;
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x280 && index == 0x2000 && sub_index == 0x02) {
-            // electronic temperature
-            sls.temp_electronics_100mdeg = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
+    }
+    
+    // Filters and masks can only be changed in configuration mode
+    mode = C1CTRL1bits.OPMODE;
+    C1CTRL1bits.REQOP = CAN_OPMODE_CONFIG;
+    while (C1CTRL1bits.OPMODE != CAN_OPMODE_CONFIG);
+    C1CTRL1bits.WIN = 1;
+    
+    // Keep the receive buffer that was set up for filter 0
+    buffer = C1BUFPNT1 & 0x000F;
+    C1FEN1 = 0;
+    
+    C1RXM0SID = (0x07FFU << 5) | CAN_MASK_MIDE;
+    C1RXM0EID = 0;
+    C1RXM1SID = ((0x07FFU << best_bits) & 0x07FF) << 5 | CAN_MASK_MIDE;
+    C1RXM1EID = 0;
+    C1RXM2SID = CAN_MASK_MIDE;
+    C1RXM2EID = 0;
+    
+    filters = can_bus_group_filters(best_bits, 1, buffer, &accepted);
+    can_bus_set_filter(CAN_FILTER_EXTENDED, 0, 1, CAN_MASK_TYPE, buffer);
+    can_bus_set_filter(CAN_FILTER_STANDARD, 0, 0, CAN_MASK_TYPE, buffer);
+    // The capture filters are switched on in can_bus_process() when needed
+    C1FEN1 = (1U << filters) - 1;
+    if (CAN_J1939_SIGNALS != 0) {
+        C1FEN1 |= 1U << CAN_FILTER_EXTENDED;
+    }
+    
+    C1CTRL1bits.WIN = 0;
+    C1CTRL1bits.REQOP = mode;
+    while (C1CTRL1bits.OPMODE != mode);
+}
+
+// Returns the target field of a signal in a copy of the decoded values
+static uint8_t *can_bus_target(const can_signal_t *signal, uint8_t copy) {
+    return (uint8_t *)signal->target + copy * sizeof(can_data_t);
+}
+
+// Copies the values the copy missed while it was held from the other copy
+static void can_bus_catch_up(void) {
+    uint8_t copy = can_data_behind;
+    uint8_t signal;
+    
+    for (signal = 0; signal < CAN_SIGNALS; signal++) {
+        if (can_data_missed[signal / 8] & (1 << (signal % 8))) {
+            memcpy(can_bus_target(&can_signals[signal], copy), can_bus_target(&can_signals[signal], copy ^ 1),
+                    CAN_TYPE_SIZE(can_signals[signal].type));
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x280 && index == 0x2001 && sub_index == 0x01) {
-            // motor 1 temperature
-            sls.temp_motor_1_100mdeg = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
+    }
+    memset(can_data_missed, 0, sizeof(can_data_missed));
+    can_data_behind = CAN_DATA_NONE;
+}
+
+// Stores the value of a signal in its target field and returns it sign extended.
+// The copy held by the reader is left alone and the value is marked missed.
+static int32_t can_bus_decode_signal(uint8_t nr, const uint8_t *data) {
+    const can_signal_t *signal = &can_signals[nr];
+    uint8_t held = can_data_held;
+    uint8_t copy;
+    uint8_t *target;
+    uint32_t value = 0;
+    uint8_t size = CAN_TYPE_IS_FLOAT(signal->type) ? 4 : CAN_TYPE_SIZE(signal->type);
+    int8_t i;
+    
+    for (i = size - 1; i >= 0; i--) {
+        value = value << 8 | data[signal->offset + i];
+    }
+    
+    if (CAN_TYPE_IS_FLOAT(signal->type)) {
+        value = utl_float_to_fixed(value, signal->scale, CAN_TYPE_IS_SIGNED(signal->type));
+    }
+    
+    // The reader moved on to the other copy, so the missed values can be copied
+    if (can_data_behind != CAN_DATA_NONE && can_data_behind != held) {
+        can_bus_catch_up();
+    }
+    for (copy = 0; copy < 2; copy++) {
+        if (copy == held) {
+            continue;
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x280 && index == 0x2001 && sub_index == 0x02) {
-            // motor 2 temperature
-            sls.temp_motor_2_100mdeg = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
+        target = can_bus_target(signal, copy);
+        switch (CAN_TYPE_SIZE(signal->type)) {
+            case 1:
+                *(uint8_t *)target = value;
+                break;
+            case 2:
+                *(uint16_t *)target = value;
+                break;
+            case 4:
+                *(uint32_t *)target = value;
+                break;
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x380 && index == 0x2000 && sub_index == 0x01) {
-            // uzk
-            sls.uzk_10mv = (uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
+    }
+    if (held != CAN_DATA_NONE) {
+        can_data_behind = held;
+        can_data_missed[nr / 8] |= 1 << (nr % 8);
+    }
+    
+    if (CAN_TYPE_IS_SIGNED(signal->type)) {
+        return CAN_TYPE_SIZE(signal->type) == 1 ? (int8_t)value : (int16_t)value;
+    }
+    return value;
+}
+
+// Compares a value with the previous one and opens a capture window when the trigger fires
+static void can_bus_trigger(uint8_t trigger, int32_t value, uint32_t timestamp_ms) {
+    int32_t previous = can_trigger_values[trigger];
+    uint8_t fired = 0;
+    
+    if (can_trigger_received[trigger]) {
+        switch (can_triggers[trigger].kind) {
+            case CAN_TRIGGER_CHANGE:
+                fired = value != previous;
+                break;
+            case CAN_TRIGGER_SET:
+                fired = (value & ~previous) != 0;
+                break;
+            case CAN_TRIGGER_STEP:
+                fired = value - previous >= can_triggers[trigger].step || previous - value >= can_triggers[trigger].step;
+                break;
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x380 && index == 0x2001 && sub_index == 0x01) {
-            // motor current
-            sls.motor_current_100ma = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
+    }
+    can_trigger_values[trigger] = value;
+    can_trigger_received[trigger] = 1;
+    if (fired) {
+        can_capture_trigger(timestamp_ms);
+    }
+}
+
+// Adds a value to the running aggregate
+static void can_bus_aggregate(can_aggregate_t *aggregate, int32_t value) {
+    if (aggregate->count == 0) {
+        aggregate->min = value;
+        aggregate->max = value;
+    } else if (value < aggregate->min) {
+        aggregate->min = value;
+    } else if (value > aggregate->max) {
+        aggregate->max = value;
+    }
+    // The mean is taken over the first values when there are more
+    if (aggregate->count < CAN_BUS_AGGREGATE_MAX_COUNT) {
+        aggregate->sum += value;
+        aggregate->count++;
+    }
+}
+
+// ECAN interrupt. Moves every received frame from the ECAN buffers into the
+// ring, so frames are not lost while the main loop waits for the sd card.
+void __attribute__((interrupt, no_auto_psv)) _C1Interrupt(void) {
+    uCAN_MSG dropped;
+    can_bus_rx_frame_t *frame;
+    uint8_t head = can_bus_rx_head;
+    uint8_t used;
+    uint32_t now = softwaretimer_get_ms();          // Receive time of the frames of this interrupt
+    
+    if (C1INTFbits.RBOVIF) {
+        can_bus_rx_stats.hardware_overflows++;
+        C1RXOVF1 = 0;
+        C1RXOVF2 = 0;
+        C1INTFbits.RBOVIF = 0;
+    }
+    if (C1INTFbits.ERRIF || C1INTFbits.IVRIF) {
+        can_stats_error_interrupt();
+    }
+    
+    // Clear the flag first, a frame received during the loop sets it again
+    C1INTFbits.RBIF = 0;
+    IFS2bits.C1IF = 0;
+    while (CAN1_messagesInBuffer() > 0) {
+        used = head - can_bus_rx_tail;
+        if (used >= CAN_BUS_RX_RING_SIZE) {
+            // Ring full, read the frame anyway to free the ECAN buffer
+            CAN1_receive(&dropped);
+            can_bus_rx_stats.ring_overflows++;
+            continue;
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x380 && index == 0x2002 && sub_index == 0x01) {
-            // input current
-            sls.input_currect_100ma = (int16_t)((uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4);
+        frame = &can_bus_rx_ring[head & (CAN_BUS_RX_RING_SIZE - 1)];
+        CAN1_receive(&frame->msg);
+        frame->timestamp_ms = now;
+        head++;
+        used++;
+        if (used > can_bus_rx_stats.high_water) {
+            can_bus_rx_stats.high_water = used;
         }
-        else if (node_id == NODE_ID_SLS && function_code == 0x380 && index == 0x2003 && sub_index == 0x01) {
-            // rpm
-            sls.rpm = (uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
+    }
+    
+    // Publish the frames
+    can_bus_rx_head = head;
+}
+
+// Decodes the values of the signals with the key, starting at the first of them.
+// Values that are not within the length bytes of data are skipped. The receive
+// time of the frame becomes the time of the values.
+static void can_bus_decode(uint8_t signal, uint8_t last, uint32_t id, uint16_t index, uint8_t sub_index,
+        const uint8_t *data, uint16_t length, uint32_t timestamp_ms) {
+    int32_t value;
+    uint8_t size;
+    
+    // 0 is kept for signals that were never received
+    if (timestamp_ms == 0) {
+        timestamp_ms = 1;
+    }
+    // A frame with more values has consecutive entries with the same key
+    while (signal < last && can_bus_compare_signal(&can_signals[signal], id, index, sub_index) == 0) {
+        size = CAN_TYPE_IS_FLOAT(can_signals[signal].type) ? 4 : CAN_TYPE_SIZE(can_signals[signal].type);
+        if (can_signals[signal].offset + size <= length) {
+            value = can_bus_decode_signal(signal, data);
+            can_signal_time[signal] = timestamp_ms;
+            if (can_signals[signal].aggregate >= 0) {
+                can_bus_aggregate(&can_aggregates[can_signals[signal].aggregate], value);
+            }
+            if (can_signals[signal].trigger >= 0) {
+                can_bus_trigger(can_signals[signal].trigger, value, timestamp_ms);
+            }
         }
-        
-        // Foil control
-        else if (node_id == NODE_ID_FOIL_CONTROL && function_code == 0x280 && index == 0x2000 && sub_index == 0x01) {
-            // Primary input position
-            foil_control.primary_input_position = (uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
+        signal++;
+    }
+}
+
+// Adds a node of the CANopen table to the pool the first time it is seen and
+// keeps the NMT state of its heartbeat
+static void can_bus_find_node(uint8_t node, uint8_t state) {
+    uint8_t i;
+    
+    if (!CAN_NODE_IS_SET(can_table_nodes, node)) {
+        return;
+    }
+    if (CAN_NODE_IS_SET(can_found_nodes, node)) {
+        for (i = 0; i < can_node_count && state != CAN_BUS_NMT_UNKNOWN; i++) {
+            if (can_nodes[i].node == node) {
+                can_nodes[i].state = state;
+            }
         }
-        else if (node_id == NODE_ID_FOIL_CONTROL && function_code == 0x280 && index == 0x2001 && sub_index == 0x01) {
-            // Primary output position
-            foil_control.primary_output_position = (uint16_t)rx_msg.frame.data5 << 8 | (uint16_t)rx_msg.frame.data4;
+        return;
+    }
+    if (can_node_count >= CAN_BUS_NODES) {
+        return;
+    }
+    
+    can_nodes[can_node_count].node = node;
+    can_nodes[can_node_count].state = state;
+    can_node_count++;
+    can_found_nodes[node / 8] |= 1 << (node % 8);
+    can_node_found_ms = softwaretimer_get_ms();
+    
+    debugprint_string("CAN node ");
+    debugprint_hex(node);
+    debugprint_string(" found\r\n");
+}
+
+static void can_bus_receive_canopen(uint16_t cob_id, const uint8_t *data, uint8_t length, uint32_t timestamp_ms) {
+    uint16_t index;
+    uint8_t sub_index, signal;
+    
+    // The toggle bit in bit 7 is only used by node guarding
+    if ((cob_id & ~CAN_COB_ID_NODE_MASK) == CAN_COB_ID_HEARTBEAT && length >= 1) {
+        can_bus_find_node(cob_id & CAN_COB_ID_NODE_MASK, data[0] & 0x7F);
+    }
+    
+    // Look up the multiplexed value first, then the frame as a whole
+    index = (uint16_t)data[2] << 8 | data[1];
+    sub_index = data[3];
+    signal = can_bus_find_signal(0, CAN_CANOPEN_SIGNALS, cob_id, index, sub_index);
+    if (signal == CAN_CANOPEN_SIGNALS) {
+        index = 0;
+        sub_index = 0;
+        signal = can_bus_find_signal(0, CAN_CANOPEN_SIGNALS, cob_id, index, sub_index);
+    }
+    if (signal < CAN_CANOPEN_SIGNALS) {
+        can_bus_find_node(cob_id & CAN_COB_ID_NODE_MASK, CAN_BUS_NMT_UNKNOWN);
+    }
+    can_bus_decode(signal, CAN_CANOPEN_SIGNALS, cob_id, index, sub_index, data, length, timestamp_ms);
+}
+
+// Decodes a complete J1939 message, the values of its source address and the
+// values taken from any source
+static void can_bus_decode_j1939(uint32_t pgn, uint8_t source, const uint8_t *data, uint16_t length,
+        uint32_t timestamp_ms) {
+    uint8_t signal;
+    
+    signal = can_bus_find_signal(CAN_CANOPEN_SIGNALS, CAN_SIGNALS, pgn, source, 0);
+    can_bus_decode(signal, CAN_SIGNALS, pgn, source, 0, data, length, timestamp_ms);
+    if (source != CAN_J1939_ANY_SOURCE) {
+        signal = can_bus_find_signal(CAN_CANOPEN_SIGNALS, CAN_SIGNALS, pgn, CAN_J1939_ANY_SOURCE, 0);
+        can_bus_decode(signal, CAN_SIGNALS, pgn, CAN_J1939_ANY_SOURCE, 0, data, length, timestamp_ms);
+    }
+}
+
+// Returns 1 when a J1939 message of the source has values in the table
+static uint8_t can_bus_is_j1939_decoded(uint32_t pgn, uint8_t source) {
+    return can_bus_find_signal(CAN_CANOPEN_SIGNALS, CAN_SIGNALS, pgn, source, 0) != CAN_SIGNALS ||
+            can_bus_find_signal(CAN_CANOPEN_SIGNALS, CAN_SIGNALS, pgn, CAN_J1939_ANY_SOURCE, 0) != CAN_SIGNALS;
+}
+
+// Returns the transfer from source to destination that is in progress,
+// CAN_BUS_J1939_SESSIONS when there is none
+static uint8_t can_bus_find_session(uint8_t source, uint8_t destination, uint32_t now) {
+    can_j1939_session_t *session;
+    uint8_t i;
+    
+    for (i = 0; i < CAN_BUS_J1939_SESSIONS; i++) {
+        session = &can_j1939_sessions[i];
+        if (session->packets != 0 && session->source == source && session->destination == destination &&
+                now - session->time <= CAN_J1939_TP_TIMEOUT_MS) {
+            return i;
         }
     }
+    return CAN_BUS_J1939_SESSIONS;
+}
+
+// Handles a transport protocol connection management frame. An announcement
+// (BAM or RTS) of a message with decoded values starts a session, the other
+// node is not answered. An abort from either side ends the session.
+static void can_bus_receive_tp_cm(uint8_t source, uint8_t destination, const uint8_t *data, uint32_t now) {
+    can_j1939_session_t *session;
+    uint32_t pgn = data[5] | (uint32_t)data[6] << 8 | (uint32_t)data[7] << 16;
+    uint16_t size = data[1] | (uint16_t)data[2] << 8;
+    uint8_t i;
+    
+    switch (data[0]) {
+        case CAN_J1939_TP_BAM:
+        case CAN_J1939_TP_RTS:
+            // A new announcement ends the earlier transfer between the same nodes
+            i = can_bus_find_session(source, destination, now);
+            if (i < CAN_BUS_J1939_SESSIONS) {
+                can_j1939_sessions[i].packets = 0;
+            }
+            if (size > CAN_BUS_J1939_MAX_SIZE || data[3] == 0 ||
+                    data[3] != (size + CAN_J1939_TP_PACKET_SIZE - 1) / CAN_J1939_TP_PACKET_SIZE ||
+                    !can_bus_is_j1939_decoded(pgn, source)) {
+                break;
+            }
+            // Take a free session or one that timed out
+            for (i = 0; i < CAN_BUS_J1939_SESSIONS; i++) {
+                session = &can_j1939_sessions[i];
+                if (session->packets == 0 || now - session->time > CAN_J1939_TP_TIMEOUT_MS) {
+                    session->pgn = pgn;
+                    session->time = now;
+                    session->size = size;
+                    session->received = 0;
+                    session->source = source;
+                    session->destination = destination;
+                    session->packets = data[3];
+                    break;
+                }
+            }
+            break;
+            
+        case CAN_J1939_TP_ABORT:
+            i = can_bus_find_session(source, destination, now);
+            if (i == CAN_BUS_J1939_SESSIONS) {
+                i = can_bus_find_session(destination, source, now);
+            }
+            if (i < CAN_BUS_J1939_SESSIONS) {
+                can_j1939_sessions[i].packets = 0;
+            }
+            break;
+    }
+}
+
+// Stores a transport protocol data packet. Packets can arrive more than once
+// when the receiver asks for them again, the message is decoded when all are there.
+static void can_bus_receive_tp_dt(uint8_t source, uint8_t destination, const uint8_t *data, uint32_t now) {
+    can_j1939_session_t *session;
+    uint16_t offset;
+    uint8_t i, length;
+    
+    i = can_bus_find_session(source, destination, now);
+    if (i == CAN_BUS_J1939_SESSIONS || data[0] == 0 || data[0] > can_j1939_sessions[i].packets) {
+        return;
+    }
+    session = &can_j1939_sessions[i];
+    offset = (uint16_t)(data[0] - 1) * CAN_J1939_TP_PACKET_SIZE;
+    length = session->size - offset < CAN_J1939_TP_PACKET_SIZE ? session->size - offset : CAN_J1939_TP_PACKET_SIZE;
+    memcpy(&session->data[offset], &data[1], length);
+    session->received |= 1U << (data[0] - 1);
+    session->time = now;
+    
+    if (session->received == (1U << session->packets) - 1) {
+        session->packets = 0;
+        can_bus_decode_j1939(session->pgn, session->source, session->data, session->size, now);
+    }
+}
+
+// Splits the 29 bit id into PGN, destination and source address
+static void can_bus_receive_j1939(uint32_t id, const uint8_t *data, uint8_t length, uint32_t timestamp_ms) {
+    uint32_t pgn = (id >> 8) & 0x3FFFFUL;
+    uint8_t source = id & 0xFF;
+    uint8_t destination = CAN_J1939_GLOBAL;
+    
+    // PDU1 PGNs are sent to a destination, in the low byte
+    if (((pgn >> 8) & 0xFF) < CAN_J1939_PDU2) {
+        destination = pgn & 0xFF;
+        pgn &= 0x3FF00UL;
+    }
+    
+    if (pgn == CAN_J1939_PGN_TP_CM && length == 8) {
+        can_bus_receive_tp_cm(source, destination, data, timestamp_ms);
+    } else if (pgn == CAN_J1939_PGN_TP_DT && length == 8) {
+        can_bus_receive_tp_dt(source, destination, data, timestamp_ms);
+    } else {
+        can_bus_decode_j1939(pgn, source, data, length, timestamp_ms);
+    }
+}
+
+// Decodes one received frame. Standard frames are CANopen, extended frames J1939.
+static void can_bus_receive_message(const can_bus_rx_frame_t *frame) {
+    const uCAN_MSG *rx_msg = &frame->msg;
+    uint8_t data[8];
+    uint8_t length;
+    
+    can_capture_add(rx_msg, frame->timestamp_ms);
+    can_stats_add(rx_msg, frame->timestamp_ms);
+    
+    // Debug data
+    /*
+    debugprint_string("R can ");
+    debugprint_hex(rx_msg->frame.id);
+    debugprint_string(" ");
+    debugprint_hex(rx_msg->frame.dlc);
+    debugprint_string("  ");
+    debugprint_hex(rx_msg->frame.data0);
+    debugprint_string(" ");
+    debugprint_hex(rx_msg->frame.data1);
+    debugprint_string(" ");
+    debugprint_hex(rx_msg->frame.data2);
+    debugprint_string(" ");
+    debugprint_hex(rx_msg->frame.data3);
+    debugprint_string("  ");
+    debugprint_hex(rx_msg->frame.data4);
+    debugprint_string(" ");
+    debugprint_hex(rx_msg->frame.data5);
+    debugprint_string(" ");
+    debugprint_hex(rx_msg->frame.data6);
+    debugprint_string(" ");
+    debugprint_hex(rx_msg->frame.data7);
+    debugprint_string("\r\n");
+    */
+    
+    if (rx_msg->frame.msgtype == CAN_MSG_RTR) {
+        return;
+    }
+    
+    data[0] = rx_msg->frame.data0;
+    data[1] = rx_msg->frame.data1;
+    data[2] = rx_msg->frame.data2;
+    data[3] = rx_msg->frame.data3;
+    data[4] = rx_msg->frame.data4;
+    data[5] = rx_msg->frame.data5;
+    data[6] = rx_msg->frame.data6;
+    data[7] = rx_msg->frame.data7;
+    length = rx_msg->frame.dlc < 8 ? rx_msg->frame.dlc : 8;
+    
+    if (rx_msg->frame.idType == CAN_FRAME_EXT) {
+        can_bus_receive_j1939(rx_msg->frame.id, data, length, frame->timestamp_ms);
+    } else {
+        can_bus_receive_canopen(rx_msg->frame.id, data, length, frame->timestamp_ms);
+    }
 }
 
 void can_bus_init(void) {
+    uint8_t i, node, nodes = 0;
+    
+    // The lookup only works on sorted tables, the J1939 part starts over
+    for (i = 1; i < CAN_SIGNALS; i++) {
+        if (i != CAN_CANOPEN_SIGNALS &&
+                can_bus_compare_signal(&can_signals[i], can_signals[i - 1].id, can_signals[i - 1].index, can_signals[i - 1].sub_index) < 0) {
+            debugprint_string("CAN signal table not sorted\r\n");
+        }
+    }
+    
+    // The nodes that are looked for, broadcasts on node 0 belong to no node
+    for (i = 0; i < CAN_CANOPEN_SIGNALS; i++) {
+        node = can_signals[i].id & CAN_COB_ID_NODE_MASK;
+        if (node != 0 && !CAN_NODE_IS_SET(can_table_nodes, node)) {
+            can_table_nodes[node / 8] |= 1 << (node % 8);
+            nodes++;
+        }
+    }
+    if (nodes > CAN_BUS_NODES) {
+        debugprint_string("CAN_BUS_NODES too small for the CANopen table\r\n");
+    }
+    can_node_found_ms = softwaretimer_get_ms();
+    
+    can_bus_init_filters();
+    
     // Enable the CAN bus
     CAN1_TransmitEnable();
     CAN1_ReceiveEnable();
     
-    
+    // Receive, buffer overflow, error state and invalid frame interrupts
+    C1INTFbits.RBIF = 0;
+    C1INTFbits.RBOVIF = 0;
+    C1INTFbits.ERRIF = 0;
+    C1INTFbits.IVRIF = 0;
+    C1INTEbits.RBIE = 1;
+    C1INTEbits.RBOVIE = 1;
+    C1INTEbits.ERRIE = 1;
+    C1INTEbits.IVRIE = 1;
+    IFS2bits.C1IF = 0;
+    IEC2bits.C1IE = 1;
 }
 
 // Needs to be called in the main loop
 void can_bus_process(void) {
-    // Read can bus message
-    can_bus_receive_messages();
+    uint8_t tail = can_bus_rx_tail;
+    uint8_t head = can_bus_rx_head;
+    uint8_t accept_all;
+    
+    // Decode all frames received since the last call. Frames that arrive in
+    // the meantime are left for the next call, so the loop always ends.
+    while (tail != head) {
+        can_bus_receive_message(&can_bus_rx_ring[tail & (CAN_BUS_RX_RING_SIZE - 1)]);
+        tail++;
+        // Free the slot
+        can_bus_rx_tail = tail;
+    }
+    
+    // Capturing all frames wants every frame on the bus, not only the decoded
+    // ones. The triggered capture keeps the filters, its windows only hold the
+    // frames they pass.
+    accept_all = can_capture_get_mode() == CAN_CAPTURE_ALL;
+    if (C1FEN1bits.FLTEN15 != accept_all) {
+        C1FEN1bits.FLTEN15 = accept_all;
+        C1FEN1bits.FLTEN14 = accept_all || CAN_J1939_SIGNALS != 0;
+    }
+    
+    can_stats_process();
     
     /*
     uCAN_MSG tx_msg;
@@ -213,22 +843,99 @@ void can_bus_process(void) {
      * */
 }
 
-mg_battery_t get_can_data_mg_battery(void) {
-    return mg_battery;
+const can_data_t *can_bus_acquire_data(void) {
+    // The decoder only marks a copy behind while the other one is held, so
+    // the choice stays valid if a frame is decoded before the hold is set
+    uint8_t copy = can_data_behind == 0 ? 1 : 0;
+    
+    can_data_held = copy;
+    return &can_data[copy];
 }
 
-mg_mppt_t get_can_data_mg_mppt(uint8_t nr) {
-    if (nr < NODE_ID_MG_MPPT_TOTAL) {
-        return mg_mppt[nr];
-    } else  {
-        return mg_mppt[0];
+void can_bus_release_data(void) {
+    can_data_held = CAN_DATA_NONE;
+}
+
+uint8_t can_bus_get_node_count(void) {
+    return can_node_count;
+}
+
+uint32_t can_bus_get_node_quiet_ms(void) {
+    return softwaretimer_get_ms() - can_node_found_ms;
+}
+
+uint8_t can_bus_is_signal_found(uint8_t signal) {
+    uint8_t node;
+    
+    if (signal >= CAN_CANOPEN_SIGNALS) {
+        return 1;
     }
+    node = can_signals[signal].id & CAN_COB_ID_NODE_MASK;
+    return node == 0 || CAN_NODE_IS_SET(can_found_nodes, node);
 }
 
-sls_t get_can_data_sls(void) {
-    return sls;
+uint8_t can_bus_is_aggregate_found(uint8_t aggregate) {
+    uint8_t signal;
+    
+    for (signal = 0; signal < CAN_SIGNALS; signal++) {
+        if (can_signals[signal].aggregate == aggregate) {
+            return can_bus_is_signal_found(signal);
+        }
+    }
+    return 1;
 }
 
-foil_control_t get_can_data_foil_control(void) {
-    return foil_control;
+void can_bus_print_nodes(void) {
+    uint8_t i;
+    
+    for (i = 0; i < can_node_count; i++) {
+        debugprint_string("  node ");
+        debugprint_hex(can_nodes[i].node);
+        if (can_nodes[i].state != CAN_BUS_NMT_UNKNOWN) {
+            debugprint_string(" state ");
+            debugprint_uint(can_nodes[i].state);
+        }
+        debugprint_string("\r\n");
+    }
+}
+
+uint32_t can_bus_get_signal_age(uint8_t signal) {
+    if (signal >= CAN_SIGNALS || can_signal_time[signal] == 0) {
+        return CAN_BUS_AGE_NEVER;
+    }
+    return softwaretimer_get_ms() - can_signal_time[signal];
+}
+
+int8_t can_bus_take_aggregate(uint8_t aggregate, can_bus_aggregate_t *result) {
+    can_aggregate_t *running;
+    int32_t half;
+    
+    if (aggregate >= CAN_AGGREGATES) {
+        return -1;
+    }
+    running = &can_aggregates[aggregate];
+    result->count = running->count;
+    result->min = 0;
+    result->max = 0;
+    result->mean = 0;
+    if (running->count != 0) {
+        result->min = running->min;
+        result->max = running->max;
+        // Integer division rounds towards 0, add half the count to round to the nearest
+        half = running->count / 2;
+        result->mean = (running->sum + (running->sum < 0 ? -half : half)) / running->count;
+    }
+    running->sum = 0;
+    running->count = 0;
+    return 0;
+}
+
+can_bus_rx_stats_t get_can_bus_rx_stats(void) {
+    can_bus_rx_stats_t stats;
+    
+    // The counters are 16 bit and each one is read in one instruction
+    stats.high_water = can_bus_rx_stats.high_water;
+    stats.ring_overflows = can_bus_rx_stats.ring_overflows;
+    stats.hardware_overflows = can_bus_rx_stats.hardware_overflows;
+    return stats;
 }
@@ -4,9 +4,27 @@
 #define	CANBUS_H
 
 #include <stdint.h>
+#include "can_signals.h"
 
 #define CAN_BUS_SEND_PERIOD_MS  1000
 
+// Number of frames the receive interrupt can hold until can_bus_process()
+// takes them out. Needs to be a power of 2.
+#define CAN_BUS_RX_RING_SIZE    32
+
+// J1939 messages of more than 8 bytes are put together from the transport
+// protocol packets, up to this size and this many transfers at the same time.
+// Longer messages are not decoded.
+#define CAN_BUS_J1939_MAX_SIZE  64
+#define CAN_BUS_J1939_SESSIONS  2
+
+// Counters of the receive path
+typedef struct {
+    uint8_t high_water;             // Most frames waiting in the ring at one time
+    uint16_t ring_overflows;        // Frames dropped because the ring was full
+    uint16_t hardware_overflows;    // Frames lost in the ECAN buffers
+}can_bus_rx_stats_t;
+
 // Initializes the can bus.
 void can_bus_init(void);
 
@@ -16,55 +34,89 @@ void can_bus_process(void);
 
 #define NODE_ID_MG_BATTERY      0x02
 #define NODE_ID_MG_MPPT         0x04
-#define NODE_ID_MG_MPPT_TOTAL   10
 #define NODE_ID_SLS             0x10
 #define NODE_ID_FOIL_CONTROL    0x11
 
+// CANopen nodes are found from their boot-up and heartbeat messages (COB-ID
+// 0x700 + node) and from any frame of the CANopen table. Only the nodes of the
+// table are looked for, each node found takes an entry of a pool of this size.
+#define CAN_BUS_NODES           16
 
-typedef struct {
-    uint16_t voltage_mv;
-    int16_t current_10ma;
-    int16_t discharge_current_10ma;
-    int16_t charge_current_10ma;
-    uint8_t soc;
-    uint16_t time_to_go_min;
-    uint32_t bms_state;
-    uint8_t temp[4];
-    uint16_t cell_voltage_mv[12];
-    uint8_t power_level;
-}mg_battery_t;
+#define CAN_BUS_NMT_UNKNOWN     0xFF    // State of a node without a heartbeat so far
 
-typedef struct {
-    int16_t current_in_ma;
-    uint16_t voltage_in_mv;
-    uint16_t voltage_out_mv;
-    int16_t power_in_100mw;
-}mg_mppt_t;
+// Returns the number of nodes found so far. It only grows, so a change means
+// there are new columns to log.
+uint8_t can_bus_get_node_count(void);
 
-typedef struct {
-    uint32_t status;
-    uint32_t limiting;
-    int16_t temp_power_100mdeg;
-    int16_t temp_electronics_100mdeg;
-    int16_t temp_motor_1_100mdeg;
-    int16_t temp_motor_2_100mdeg;
-    uint16_t uzk_10mv;
-    int16_t motor_current_100ma;
-    int16_t input_currect_100ma;
-    int16_t rpm;
-}sls_t;
+// Returns the time in ms since the last new node was found, or since can_bus_init()
+uint32_t can_bus_get_node_quiet_ms(void);
+
+// Returns 1 when a value belongs to a node that was found. J1939 values and
+// CANopen broadcasts like SYNC belong to no node and always return 1.
+// Parameters:
+//  signal          Position of the signal in the decode tables, as in CAN_COLUMN_TABLE
+uint8_t can_bus_is_signal_found(uint8_t signal);
+
+// Same as can_bus_is_signal_found() for the value of a position in CAN_AGGREGATE_TABLE
+uint8_t can_bus_is_aggregate_found(uint8_t aggregate);
 
+// Prints the nodes found and their NMT state on the debug uart
+void can_bus_print_nodes(void);
+
+
+// The structs with the decoded values are generated from can_signals.csv
+#define CAN_FIELD(type, name, dims)     type name dims;
+#define CAN_STRUCT(name, dims)          typedef struct { CAN_FIELDS_##name(CAN_FIELD) } name##_t;
+CAN_STRUCTS(CAN_STRUCT)
+
+// All decoded values
+#define CAN_DATA_MEMBER(name, dims)     name##_t name dims;
 typedef struct {
-    uint16_t primary_input_position;
-    uint16_t primary_output_position;
-}foil_control_t;
+    CAN_STRUCTS(CAN_DATA_MEMBER)
+}can_data_t;
+
+// Returns all decoded values as received up to now, without copying them.
+// The values do not change until can_bus_release_data(), frames decoded in
+// the meantime go into a second copy. Only one reader can hold the values.
+const can_data_t *can_bus_acquire_data(void);
+
+// Ends the hold of can_bus_acquire_data(), the pointer must not be used afterwards
+void can_bus_release_data(void);
 
-mg_battery_t get_can_data_mg_battery(void);
+#define CAN_BUS_AGE_NEVER       0xFFFFFFFFUL
+
+// Returns the time since a signal was last received.
+// Parameters:
+//  signal          Position of the signal in the decode tables, as in CAN_COLUMN_TABLE
+// Returns:
+//  Age in ms, CAN_BUS_AGE_NEVER if the signal was not received yet.
+uint32_t can_bus_get_signal_age(uint8_t signal);
+
+// Values of an aggregate are counted up to this, so the sum of 16 bit values fits in 32 bits
+#define CAN_BUS_AGGREGATE_MAX_COUNT     32767
+
+// Min, max and mean of an aggregated value over an interval, see CAN_AGGREGATE_TABLE
+typedef struct {
+    int32_t min;
+    int32_t max;
+    int32_t mean;                   // Rounded to the nearest integer
+    uint16_t count;                 // Values received, min, max and mean are 0 when there were none
+}can_bus_aggregate_t;
 
-mg_mppt_t get_can_data_mg_mppt(uint8_t nr);
+// Returns the aggregate of a value since the last call and starts a new interval.
+// Parameters:
+//  aggregate       Position in CAN_AGGREGATE_TABLE
+//  *result         Filled with min, max and mean
+// Returns:
+//  0 on success, -1 if the aggregate does not exist.
+int8_t can_bus_take_aggregate(uint8_t aggregate, can_bus_aggregate_t *result);
 
-sls_t get_can_data_sls(void);
+// Kinds of the triggers in CAN_TRIGGER_TABLE. A trigger opens a window of the
+// raw capture, see can_capture_trigger(). The first value received never fires.
+#define CAN_TRIGGER_CHANGE      0       // The value changed
+#define CAN_TRIGGER_SET         1       // A bit that was 0 is set, like a new error flag
+#define CAN_TRIGGER_STEP        2       // The value changed by at least the step
 
-foil_control_t get_can_data_foil_control(void);
+can_bus_rx_stats_t get_can_bus_rx_stats(void);
 
 #endif	
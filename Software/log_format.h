@@ -0,0 +1,89 @@
+/* 
+ * File:                log_format.h
+ * Comments:            Layout of the binary log files.
+ *                      Shared between the firmware and the PC tools, so only
+ *                      plain C and stdint types are used here.
+ */
+
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef LOG_FORMAT_H
+#define	LOG_FORMAT_H
+
+#include <stdint.h>
+
+// A binary log file (LOGn.BIN) starts with a schema block followed by fixed size
+// records. All values are little endian.
+//
+// Blocks (version 3 and up):
+//  The file is written in blocks of LOG_FORMAT_BLOCK_SIZE bytes. The last
+//  LOG_FORMAT_TRAILER_SIZE bytes of each block are a trailer, the schema and records
+//  below continue in the data part of the next block. The last block of the file
+//  can be incomplete and has no trailer.
+// Trailer:
+//  uint32_t    Block sequence number. Counts on over the files of a session,
+//              so missing blocks and files can be found.
+//  uint16_t    CRC 16 CCITT (polynomial 0x1021, start value 0x1D0F) of the block
+//              up to this field
+//
+// Schema block:
+//  4 bytes     LOG_FORMAT_MAGIC
+//  uint8_t     LOG_FORMAT_VERSION
+//  uint8_t     Encoding of the records, LOG_FORMAT_ENCODING_*
+//  uint16_t    Number of columns
+//  uint16_t    Record size in bytes
+// Then for each column:
+//  uint8_t     Type, LOG_TYPE_*
+//  int8_t      Scale as power of 10. The real value is raw * 10^scale
+//  uint8_t     Group the column is sampled with (version 2 and up)
+//  uint8_t     Length of the name
+//  char[]      Name, not zero terminated. The name is the csv header text.
+// Columns of type LOG_TYPE_STALE (version 4 and up) are not csv columns. They are
+// bitmaps of the columns with a stale value: the n-th of them has a bit for the
+// columns 8n to 8n + 7, lowest bit first. A set bit means the value was not
+// received recently or at all, its csv cell is left empty.
+//
+// Record:
+//  uint8_t     Bit mask of the groups sampled for this record (version 2 and up).
+//              Columns of the other groups repeat an earlier value and are left
+//              empty in the csv.
+//  The columns in schema order, each packed in the size of its type.
+//
+// Delta encoded records (LOG_FORMAT_ENCODING_DELTA) start with the group byte:
+//  Bit 7 set       Keyframe: the full record as above with LOG_FORMAT_KEYFRAME set
+//                  in the group byte. Keyframes start at the beginning of a block,
+//                  so decoding can start at any keyframe with all values known.
+//  Bit 7 clear     Delta record. A bitmap follows with one bit per column of the
+//                  sampled groups in schema order, lowest bit first, rounded up to
+//                  whole bytes. A set bit means the column changed. For each changed
+//                  column follows the difference to its previous value, taken in the
+//                  width of the column type and zig-zag encoded ((d << 1) ^ (d >> 31)),
+//                  as varint: 7 bits per byte lowest first, bit 7 set when more follow.
+//  0x00            Padding until the end of the data part of the block.
+// The record size in the schema block is the size of a keyframe.
+
+#define LOG_FORMAT_MAGIC            "SFLG"
+#define LOG_FORMAT_VERSION          4
+
+#define LOG_FORMAT_ENCODING_PACKED  0       // Fixed size packed records
+#define LOG_FORMAT_ENCODING_DELTA   1       // Delta records and keyframes
+
+#define LOG_FORMAT_KEYFRAME         0x80
+#define LOG_FORMAT_PADDING          0x00
+#define LOG_FORMAT_BLOCK_SIZE       512
+#define LOG_FORMAT_TRAILER_SIZE     6
+
+// Column types. The lower nibble is the size in bytes, bit 7 is set for signed types.
+#define LOG_TYPE_U8                 0x01
+#define LOG_TYPE_U16                0x02
+#define LOG_TYPE_U32                0x04
+#define LOG_TYPE_I8                 0x81
+#define LOG_TYPE_I16                0x82
+#define LOG_TYPE_I32                0x84
+#define LOG_TYPE_STALE              0x41    // 8 bit bitmap, bit 6 marks it as not a value
+
+#define LOG_TYPE_SIZE(type)         ((type) & 0x0F)
+#define LOG_TYPE_IS_SIGNED(type)    (((type) & 0x80) != 0)
+
+#endif	/* LOG_FORMAT_H */
+
@@ -0,0 +1,266 @@
+/*
+ * File:   log_row.c
+ *
+ * The columns of a log row. log_row_columns and log_row_sample() are both
+ * expanded from LOG_ROW_FIXED_COLUMNS and the generated CAN_COLUMN_TABLE and
+ * CAN_AGGREGATE_COLUMN_TABLE, so the values always match the columns. The group of a column decides if
+ * log_row_put() takes the new value or the column keeps the previous one.
+ * Rows only hold the columns of the layout, log_row_layout has their positions
+ * in log_row_columns. Columns of nodes that are not on the bus are left out.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "log_row.h"
+#include "log_format.h"
+#include "canbus.h"
+#include "can_stats.h"
+#include "gps.h"
+#include "softwaretimer.h"
+#include "utl.h"
+
+#define LOG_ROW_COLUMN(name, type, scale, group, ...)   {name, type, scale, group},
+
+static const log_column_t log_row_columns[LOG_ROW_COLUMNS] = {
+    LOG_ROW_FIXED_COLUMNS(LOG_ROW_COLUMN)
+    CAN_COLUMN_TABLE(LOG_ROW_COLUMN)
+    LOG_ROW_AGGREGATE_COLUMNS(LOG_ROW_COLUMN)
+    [LOG_ROW_VALUE_COLUMNS ... LOG_ROW_COLUMNS - 1] = {"Stale", LOG_TYPE_STALE, 0, LOG_GROUP_LOGGER},
+};
+
+static uint8_t log_row_layout[LOG_ROW_COLUMNS];
+static uint8_t log_row_value_columns = 0;
+static uint8_t log_row_layout_columns = 0;
+static uint16_t log_row_record_size = 1;
+
+static uint32_t *log_row_values;
+static uint8_t log_row_column;          // Next column of the layout
+static uint8_t log_row_table_column;    // Next column of log_row_columns
+static uint8_t log_row_groups;
+static uint8_t log_row_stale[LOG_ROW_STALE_COLUMNS];
+
+// Adds the next column of log_row_columns to the layout when its node was found
+static void log_row_add(uint8_t found) {
+    if (found) {
+        log_row_layout[log_row_value_columns++] = log_row_table_column;
+        log_row_record_size += LOG_TYPE_SIZE(log_row_columns[log_row_table_column].type);
+    }
+    log_row_table_column++;
+}
+
+#define LOG_ROW_ADD(name, type, scale, group, value)                log_row_add(1);
+#define LOG_ROW_ADD_CAN(name, type, scale, group, value, signal)    log_row_add(can_bus_is_signal_found(signal));
+#define LOG_ROW_ADD_AGGREGATE(name, type, scale, group, aggregate, statistic) \
+    log_row_add(can_bus_is_aggregate_found(aggregate));
+
+void log_row_update_layout(void) {
+    uint8_t i, stale;
+    
+    log_row_table_column = 0;
+    log_row_value_columns = 0;
+    log_row_record_size = 1;
+    LOG_ROW_FIXED_COLUMNS(LOG_ROW_ADD)
+    CAN_COLUMN_TABLE(LOG_ROW_ADD_CAN)
+    LOG_ROW_AGGREGATE_COLUMNS(LOG_ROW_ADD_AGGREGATE)
+    
+    // The stale bitmaps only have bits for the value columns of the layout
+    stale = (log_row_value_columns + 7) / 8;
+    for (i = 0; i < stale; i++) {
+        log_row_layout[log_row_value_columns + i] = LOG_ROW_VALUE_COLUMNS + i;
+    }
+    log_row_layout_columns = log_row_value_columns + stale;
+    log_row_record_size += stale;
+}
+
+uint8_t log_row_get_value_columns(void) {
+    return log_row_value_columns;
+}
+
+uint8_t log_row_get_columns(void) {
+    return log_row_layout_columns;
+}
+
+uint16_t log_row_get_record_size(void) {
+    return log_row_record_size;
+}
+
+const log_column_t *log_row_get_column(uint8_t column) {
+    return &log_row_columns[log_row_layout[column]];
+}
+
+// Stores the value of the next column if it is in the layout and its group is
+// sampled. A stale value is marked in the stale bitmaps.
+static void log_row_put_value(uint32_t value, uint8_t stale) {
+    if (log_row_column < log_row_value_columns && log_row_layout[log_row_column] == log_row_table_column) {
+        if (stale) {
+            log_row_stale[log_row_column / 8] |= 1 << (log_row_column % 8);
+        }
+        if (log_row_groups & LOG_GROUP_BIT(log_row_columns[log_row_table_column].group)) {
+            log_row_values[log_row_column] = value;
+        }
+        log_row_column++;
+    }
+    log_row_table_column++;
+}
+
+static void log_row_put(uint32_t value) {
+    log_row_put_value(value, 0);
+}
+
+// Stores the value of the next column, which is marked stale when the signal is too old
+static void log_row_put_can(uint32_t value, uint8_t signal) {
+    log_row_put_value(value, LOG_ROW_STALE_MS != 0 && can_bus_get_signal_age(signal) > LOG_ROW_STALE_MS);
+}
+
+// Stores a statistic of an aggregate, which is marked stale when the value was not received
+static void log_row_put_aggregate(uint32_t value, const can_bus_aggregate_t *aggregate) {
+    log_row_put_value(value, aggregate->count == 0);
+}
+
+// Signed values are cast to int32_t first to sign extend them
+#define LOG_ROW_PUT(name, type, scale, group, value)                log_row_put((int32_t)(value));
+#define LOG_ROW_PUT_CAN(name, type, scale, group, value, signal)    log_row_put_can((int32_t)can_data->value, signal);
+#define LOG_ROW_PUT_AGGREGATE(name, type, scale, group, aggregate, statistic) \
+    log_row_put_aggregate(aggregates[aggregate].statistic, &aggregates[aggregate]);
+
+// The interval of an aggregate ends when its group is sampled
+#define LOG_ROW_TAKE_AGGREGATE(aggregate, group) \
+    if (log_row_groups & LOG_GROUP_BIT(group)) { \
+        can_bus_take_aggregate(aggregate, &aggregates[aggregate]); \
+    }
+
+void log_row_sample(uint32_t counter, uint8_t groups, uint32_t *values) {
+    gps_time_t gps_time;
+    gps_coordinates_t gps_coordinates;
+    gps_speed_t gps_speed;
+    const can_data_t *can_data;
+    can_stats_t can_stats;
+    can_bus_aggregate_t aggregates[CAN_AGGREGATES] = {};
+    uint8_t i;
+    
+    log_row_values = values;
+    log_row_column = 0;
+    log_row_table_column = 0;
+    log_row_groups = groups | LOG_GROUP_BIT(LOG_GROUP_LOGGER);
+    memset(log_row_stale, 0, sizeof(log_row_stale));
+    
+    gps_time = get_gps_time();
+    gps_coordinates = get_gps_coordinates();
+    gps_speed = get_gps_speed();
+    can_data = can_bus_acquire_data();
+    can_stats_get(&can_stats);
+#if LOG_ROW_AGGREGATES
+    CAN_AGGREGATE_TABLE(LOG_ROW_TAKE_AGGREGATE)
+#endif
+    
+    LOG_ROW_FIXED_COLUMNS(LOG_ROW_PUT)
+    CAN_COLUMN_TABLE(LOG_ROW_PUT_CAN)
+    can_bus_release_data();
+    LOG_ROW_AGGREGATE_COLUMNS(LOG_ROW_PUT_AGGREGATE)
+    for (i = log_row_value_columns; i < log_row_layout_columns; i++) {
+        values[i] = log_row_stale[i - log_row_value_columns];
+    }
+}
+
+uint8_t log_row_is_stale(const uint32_t *values, uint8_t column) {
+    return (values[log_row_value_columns + column / 8] >> (column % 8)) & 1;
+}
+
+uint16_t log_row_pack(const uint32_t *values, uint8_t groups, uint8_t *buffer) {
+    uint8_t *start = buffer;
+    uint8_t i, size;
+    uint32_t value;
+    
+    *buffer++ = groups;
+    for (i = 0; i < log_row_layout_columns; i++) {
+        value = values[i];
+        // Little endian, only the bytes of the column type
+        for (size = LOG_TYPE_SIZE(log_row_get_column(i)->type); size != 0; size--) {
+            *buffer++ = value;
+            value >>= 8;
+        }
+    }
+    return buffer - start;
+}
+
+// Writes a value as varint, 7 bits per byte starting with the lowest.
+// Bit 7 is set when another byte follows.
+static uint8_t log_row_put_varint(uint8_t *buffer, uint32_t value) {
+    uint8_t length = 0;
+    
+    while (value >= 0x80) {
+        buffer[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[length++] = value;
+    return length;
+}
+
+uint16_t log_row_encode(const uint32_t *values, uint8_t groups, uint8_t *previous, uint8_t *buffer) {
+    uint8_t *start = buffer;
+    uint8_t *bitmap;
+    uint8_t *old = previous + 1;
+    uint8_t i, b, size, bit = 0;
+    uint32_t value, delta;
+    
+    *buffer++ = groups;
+    previous[0] = groups;
+    
+    // The bitmap has a bit for each column of the sampled groups. Reserve room for it.
+    for (i = 0; i < log_row_layout_columns; i++) {
+        if (groups & LOG_GROUP_BIT(log_row_get_column(i)->group)) {
+            bit++;
+        }
+    }
+    bitmap = buffer;
+    memset(bitmap, 0, (bit + 7) / 8);
+    buffer += (bit + 7) / 8;
+    
+    bit = 0;
+    for (i = 0; i < log_row_layout_columns; i++) {
+        size = LOG_TYPE_SIZE(log_row_get_column(i)->type);
+        if (groups & LOG_GROUP_BIT(log_row_get_column(i)->group)) {
+            value = 0;
+            for (b = 0; b < size; b++) {
+                value |= (uint32_t)old[b] << (8 * b);
+            }
+            
+            // Difference in the width of the column, sign extended and zig-zag
+            // encoded so small changes in both directions give small numbers
+            delta = values[i] - value;
+            if (size < 4) {
+                delta <<= 32 - 8 * size;
+                delta = (uint32_t)((int32_t)delta >> (32 - 8 * size));
+            }
+            delta = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+            
+            if (delta != 0) {
+                bitmap[bit / 8] |= 1 << (bit % 8);
+                buffer += log_row_put_varint(buffer, delta);
+                value = values[i];
+                for (b = 0; b < size; b++) {
+                    old[b] = value;
+                    value >>= 8;
+                }
+            }
+            bit++;
+        }
+        old += size;
+    }
+    return buffer - start;
+}
+
+uint8_t log_row_format_cell(char *str, uint8_t column, const uint32_t *values, uint8_t groups) {
+    const log_column_t *description = log_row_get_column(column);
+    uint8_t length = 0;
+    
+    if ((groups & LOG_GROUP_BIT(description->group)) && !log_row_is_stale(values, column)) {
+        if (LOG_TYPE_IS_SIGNED(description->type)) {
+            length = utl_int32_format((int32_t)values[column], str);
+        } else {
+            length = utl_uint32_format(values[column], str);
+        }
+    }
+    str[length] = ';';
+    return length + 1;
+}
@@ -0,0 +1,184 @@
+/* 
+ * File:                log_row.h
+ * Comments:            Columns of a log row. Samples all signals into one row of
+ *                      raw values which is then written as csv or binary record.
+ *                      The columns are divided in groups which can be sampled
+ *                      at their own rate.
+ */
+
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef LOG_ROW_H
+#define	LOG_ROW_H
+
+#include <stdint.h>
+#include "log_format.h"
+#include "can_signals.h"
+
+// Column groups
+#define LOG_GROUP_LOGGER        0       // Counter and time, part of every row
+#define LOG_GROUP_GPS           1
+#define LOG_GROUP_BATTERY       2
+#define LOG_GROUP_CELLS         3       // Battery temperatures and cell voltages
+#define LOG_GROUP_MPPT          4
+#define LOG_GROUP_SLS           5
+#define LOG_GROUP_FOIL          6
+#define LOG_ROW_GROUPS          7
+
+#define LOG_GROUP_BIT(group)    (1 << (group))
+#define LOG_GROUP_ALL           ((1 << LOG_ROW_GROUPS) - 1)
+
+#if LOG_ROW_GROUPS > 7
+#error "The group mask shares its byte with LOG_FORMAT_KEYFRAME"
+#endif
+
+// Columns in front of the columns decoded from the CAN bus (CAN_COLUMN_TABLE in
+// can_signals.h). X(name, type, scale, group, value), the values are taken in log_row_sample().
+// The bus columns come from can_stats.h and change once per CAN_STATS_PERIOD_MS.
+// Rates, load and ids only count the frames passed by the acceptance filters.
+#define LOG_ROW_FIXED_COLUMNS(X) \
+    X("Log counter",    LOG_TYPE_U32,   0,  LOG_GROUP_LOGGER,   counter) \
+    X("Uptime ms",      LOG_TYPE_U32,   0,  LOG_GROUP_LOGGER,   softwaretimer_get_ms()) \
+    X("Day",            LOG_TYPE_U8,    0,  LOG_GROUP_GPS,      gps_time.day) \
+    X("Month",          LOG_TYPE_U8,    0,  LOG_GROUP_GPS,      gps_time.month) \
+    X("Year",           LOG_TYPE_U8,    0,  LOG_GROUP_GPS,      gps_time.year) \
+    X("Hour",           LOG_TYPE_U8,    0,  LOG_GROUP_GPS,      gps_time.hour) \
+    X("Min",            LOG_TYPE_U8,    0,  LOG_GROUP_GPS,      gps_time.min) \
+    X("Sec",            LOG_TYPE_U8,    0,  LOG_GROUP_GPS,      gps_time.sec) \
+    X("Latitude deg",   LOG_TYPE_I16,   0,  LOG_GROUP_GPS,      gps_coordinates.latitude_degrees) \
+    X("Latitude min",   LOG_TYPE_U32,   -5, LOG_GROUP_GPS,      gps_coordinates.latitude_minutes) \
+    X("Longitude deg",  LOG_TYPE_I16,   0,  LOG_GROUP_GPS,      gps_coordinates.longitude_degrees) \
+    X("Longitude min",  LOG_TYPE_U32,   -5, LOG_GROUP_GPS,      gps_coordinates.longitude_minutes) \
+    X("Direction",      LOG_TYPE_U16,   -1, LOG_GROUP_GPS,      gps_speed.direction_degrees) \
+    X("Speed",          LOG_TYPE_U16,   -2, LOG_GROUP_GPS,      gps_speed.speed_kmh) \
+    X("Filtered frames/s", LOG_TYPE_U16, 0, LOG_GROUP_LOGGER,   can_stats.frame_rate) \
+    X("Filtered bus load %", LOG_TYPE_U16, -1, LOG_GROUP_LOGGER, can_stats.bus_load) \
+    X("Filtered ids",   LOG_TYPE_U8,    0,  LOG_GROUP_LOGGER,   can_stats.ids) \
+    X("Bus state",      LOG_TYPE_U8,    0,  LOG_GROUP_LOGGER,   can_stats.state) \
+    X("Bus TEC",        LOG_TYPE_U8,    0,  LOG_GROUP_LOGGER,   can_stats.tec) \
+    X("Bus REC",        LOG_TYPE_U8,    0,  LOG_GROUP_LOGGER,   can_stats.rec) \
+    X("Bus invalid",    LOG_TYPE_U16,   0,  LOG_GROUP_LOGGER,   can_stats.invalid_frames) \
+    X("Bus warnings",   LOG_TYPE_U16,   0,  LOG_GROUP_LOGGER,   can_stats.warnings) \
+    X("Bus passive",    LOG_TYPE_U16,   0,  LOG_GROUP_LOGGER,   can_stats.passives) \
+    X("Bus off",        LOG_TYPE_U16,   0,  LOG_GROUP_LOGGER,   can_stats.bus_offs) \
+    X("Rx ring overflows", LOG_TYPE_U16, 0, LOG_GROUP_LOGGER,   can_stats.ring_overflows) \
+    X("Rx ECAN overflows", LOG_TYPE_U16, 0, LOG_GROUP_LOGGER,   can_stats.hardware_overflows)
+
+// Set to 1 to log the min, max and mean of the values marked in the aggregate
+// column of can_signals.csv (CAN_AGGREGATE_COLUMN_TABLE), over the time since
+// their group was last sampled. The columns follow the other CAN columns.
+#define LOG_ROW_AGGREGATES      1
+
+#if LOG_ROW_AGGREGATES
+#define LOG_ROW_AGGREGATE_COLUMNS(X)    CAN_AGGREGATE_COLUMN_TABLE(X)
+#else
+#define LOG_ROW_AGGREGATE_COLUMNS(X)
+#endif
+
+// A CAN value that was not received for this long, or not at all, is marked
+// stale and its csv cell is left empty. 0 logs all values however old they are.
+#define LOG_ROW_STALE_MS        5000
+
+// Sizes with the columns of all nodes follow from the column tables at compile time.
+// A file only has the columns of the nodes found on the bus, see log_row_update_layout().
+#define LOG_ROW_COUNT(name, type, ...)          + 1
+#define LOG_ROW_SIZE(name, type, ...)           + LOG_TYPE_SIZE(type)
+#define LOG_ROW_VARINT_SIZE(name, type, ...)    + LOG_TYPE_SIZE(type) + 1
+
+// The value columns are followed by LOG_TYPE_STALE columns with a bit for each
+// value column, see log_format.h
+#define LOG_ROW_VALUE_COLUMNS   (0 LOG_ROW_FIXED_COLUMNS(LOG_ROW_COUNT) CAN_COLUMN_TABLE(LOG_ROW_COUNT) \
+        LOG_ROW_AGGREGATE_COLUMNS(LOG_ROW_COUNT))
+#define LOG_ROW_STALE_COLUMNS   ((LOG_ROW_VALUE_COLUMNS + 7) / 8)
+#define LOG_ROW_COLUMNS         (LOG_ROW_VALUE_COLUMNS + LOG_ROW_STALE_COLUMNS)
+// Group byte plus the sum of the sizes of all column types
+#define LOG_ROW_RECORD_SIZE     (1 + LOG_ROW_STALE_COLUMNS \
+        LOG_ROW_FIXED_COLUMNS(LOG_ROW_SIZE) CAN_COLUMN_TABLE(LOG_ROW_SIZE) \
+        LOG_ROW_AGGREGATE_COLUMNS(LOG_ROW_SIZE))
+// Delta record with the largest varint for every column
+#define LOG_ROW_ENCODED_MAX_SIZE    (1 + (LOG_ROW_COLUMNS + 7) / 8 + 2 * LOG_ROW_STALE_COLUMNS \
+        LOG_ROW_FIXED_COLUMNS(LOG_ROW_VARINT_SIZE) CAN_COLUMN_TABLE(LOG_ROW_VARINT_SIZE) \
+        LOG_ROW_AGGREGATE_COLUMNS(LOG_ROW_VARINT_SIZE))
+// Longest csv cell, "-2147483648;"
+#define LOG_ROW_CSV_CELL_SIZE   12
+
+#if LOG_ROW_COLUMNS > 255
+#error "Columns are counted in 8 bits"
+#endif
+
+typedef struct {
+    const char *name;       // Column name as used in the csv header
+    uint8_t type;           // LOG_TYPE_*
+    int8_t scale;           // Power of 10 to get the real value
+    uint8_t group;          // LOG_GROUP_*
+} log_column_t;
+
+// Takes the columns of the CANopen nodes found so far into the layout, see
+// can_bus_is_signal_found(). The columns of the other nodes are left out of the
+// rows, the csv header and the schema. The columns move, so only call this
+// before the first row of a file.
+void log_row_update_layout(void);
+
+// Returns the number of value columns in the layout, the columns of the csv
+uint8_t log_row_get_value_columns(void);
+
+// Returns the number of columns in the layout, the value columns followed by
+// the LOG_TYPE_STALE columns
+uint8_t log_row_get_columns(void);
+
+// Returns the size in bytes of a record packed by log_row_pack()
+uint16_t log_row_get_record_size(void);
+
+// Returns the description of a column in the layout.
+// Parameters:
+//  column          Below log_row_get_columns()
+const log_column_t *log_row_get_column(uint8_t column);
+
+// Samples the signals of the given groups into a row. The columns of the
+// other groups keep their value.
+// Signed values are stored sign extended.
+// Parameters:
+//  counter         The log counter, stored in the first column
+//  groups          Groups to sample, LOG_GROUP_BIT() of each group
+//  *values         Array of LOG_ROW_COLUMNS values, the columns of the layout are filled
+void log_row_sample(uint32_t counter, uint8_t groups, uint32_t *values);
+
+// Returns 1 when the value of a column is stale in a sampled row.
+// Parameters:
+//  *values         The sampled row
+//  column          A value column, below log_row_get_value_columns()
+uint8_t log_row_is_stale(const uint32_t *values, uint8_t column);
+
+// Packs a row into a binary record.
+// Parameters:
+//  *values         The sampled row
+//  groups          The groups sampled for this row
+//  *buffer         Buffer of log_row_get_record_size() bytes
+// Returns:
+//  The number of bytes written to the buffer
+uint16_t log_row_pack(const uint32_t *values, uint8_t groups, uint8_t *buffer);
+
+// Delta encodes a row against the previous one, see log_format.h.
+// Parameters:
+//  *values         The sampled row
+//  groups          The groups sampled for this row
+//  *previous       The previous row as packed record. Updated to this row.
+//  *buffer         Buffer of LOG_ROW_ENCODED_MAX_SIZE bytes
+// Returns:
+//  The number of bytes written to the buffer
+uint16_t log_row_encode(const uint32_t *values, uint8_t groups, uint8_t *previous, uint8_t *buffer);
+
+// Formats a value column of a row as csv cell, the decimal value followed by ';'.
+// The cell is empty when the group of the column was not sampled or the value is stale.
+// The string is not null terminated.
+// Parameters:
+//  *str            Buffer of LOG_ROW_CSV_CELL_SIZE bytes
+//  column          A value column, below log_row_get_value_columns()
+//  *values         The sampled row
+//  groups          The groups sampled for this row
+// Returns:
+//  The number of characters written
+uint8_t log_row_format_cell(char *str, uint8_t column, const uint32_t *values, uint8_t groups);
+
+#endif	/* LOG_ROW_H */
+
@@ -6,15 +6,65 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include "mcc_generated_files/system.h"
 #include "mcc_generated_files/pin_manager.h"
 #include "mcc_generated_files/watchdog.h"
+#include "mcc_generated_files/uart1.h"
 
 #include "softwaretimer.h"
 #include "debugprint.h"
 #include "canbus.h"
+#include "can_stats.h"
 #include "sd_logger.h"
 #include "gps.h"
+#include "utl.h"
+
+// Commands over the debug uart. s prints the bus statistics right away, the
+// others end with a line end and answer OK or Invalid:
+//  r<hz>           Rows per second, sd_logger_set_rate()
+//  g<group>=<hz>   Rate of a column group (LOG_GROUP_* in log_row.h), sd_logger_set_group_rate()
+#define MAIN_COMMAND_SIZE   12
+
+static void main_uart_command(char c) {
+    static char command[MAIN_COMMAND_SIZE];
+    static uint8_t length = 0;
+    char *separator;
+    uint32_t group = 0, rate_hz = 0;
+    int8_t res = -1;
+    
+    if (length == 0 && c == 's') {
+        can_stats_print();
+        can_bus_print_nodes();
+        return;
+    }
+    if (c != '\r' && c != '\n') {
+        if (length < MAIN_COMMAND_SIZE - 1) {
+            command[length++] = c;
+        }
+        return;
+    }
+    if (length == 0) {
+        return;
+    }
+    command[length] = '\0';
+    length = 0;
+    
+    if (command[0] == 'r') {
+        rate_hz = utl_string_to_uint32(&command[1], 10);
+        if (rate_hz <= 0xFF) {
+            res = sd_logger_set_rate(rate_hz);
+        }
+    } else if (command[0] == 'g' && (separator = strchr(command, '=')) != NULL) {
+        *separator = '\0';
+        group = utl_string_to_uint32(&command[1], 10);
+        rate_hz = utl_string_to_uint32(separator + 1, 10);
+        if (group <= 0xFF && rate_hz <= 0xFF) {
+            res = sd_logger_set_group_rate(group, rate_hz);
+        }
+    }
+    debugprint_string(res == 0 ? "OK\r\n" : "Invalid\r\n");
+}
 
 // Main application
 int main(void) {
@@ -64,6 +114,11 @@ int main(void) {
         gps_handler();
         sd_logger_process();
         
+        // Commands over the debug uart
+        if (!UART1_ReceiveBufferIsEmpty()) {
+            main_uart_command(UART1_Read());
+        }
+        
         // Triggers every 1 sec
         if (softwaretimer_get_expired(one_sec_timer) == 1) {
             softwaretimer_start(led_timer, 50);
@@ -89,13 +144,16 @@ int main(void) {
         // If the switch was held down for 3 sec we go into infinite while loop doing nothing.
         // This enables the user to safely remove the sd card without corrupting it.
         if (switch_counter >= 3) {
+            sd_logger_stop();
             IO_LED_G_SetHigh();
             while(1);
         }
         
         // If the under voltage is triggered we wait until either the us is shut down or the voltage goes back up.
-        // No data is written to the sd card to prevent corruption.
+        // The buffered data is committed first, after that nothing is written to the sd card to prevent corruption.
+        // Data written after the last flush is recovered at the next boot if the hold-up time runs out first.
         if (!IO_UVP_GetValue()) {
+            sd_logger_flush();
             IO_LED_R_SetHigh();
             debugprint_string("UVP ERROR! Going to sleep.\r\n");
             while (!IO_UVP_GetValue()) {
@@ -0,0 +1,500 @@
+/*
+ * File:   sd_file.c
+ *
+ * Buffered log file writer. Opening, seeking to the end and closing a file
+ * through FILEIO walks the FAT chain and rewrites the directory entry each
+ * time, so the file is kept open and only whole sectors are written.
+ *
+ * Appending through FILEIO also allocates clusters on the fly, which updates
+ * the FAT and causes long write stalls. A pre-allocated file has all its
+ * clusters allocated at open. When they form one contiguous area, the
+ * sectors are written straight to their address on the card. The directory
+ * entry only holds the size up to the last flush until the file is closed.
+ * Consecutive sectors are written with one multi block write. A complete
+ * sector is sent by DMA while the next one is filled in the other buffer.
+ *
+ * FILEIO uses the same SPI bus, so the multi block write is closed before
+ * every FILEIO call.
+ *
+ * The pre-allocated sectors are zero until written and always written in
+ * order. They are never pre-erased with ACMD23, an erased block may read
+ * 0xFF. After a power loss the data past the size in the directory entry
+ * can therefore be found again by sd_file_recover().
+ */
+
+#include <xc.h>
+#include <stdint.h>
+#include <string.h>
+#include "sd_file.h"
+#include "mla_fileio/fileio.h"
+#include "mla_fileio/fileio_private.h"
+#include "mla_fileio/sd_spi.h"
+#include "sd_stream.h"
+#include "mcc_generated_files/pin_manager.h"
+#include "debugprint.h"
+#include "utl.h"
+
+// Reset the uc when this many writes in a row failed
+#define SD_FILE_MAX_WRITE_ERRORS    16
+
+// State of the next file
+#define SD_FILE_NEXT_NONE       0
+#define SD_FILE_NEXT_PREPARING  1
+#define SD_FILE_NEXT_READY      2
+
+static FILEIO_SD_DRIVE_CONFIG *sd_file_media = 0;
+
+// Written to allocate the clusters of a new file
+static const uint8_t sd_file_empty_sector[SD_FILE_SECTOR_SIZE] = {0};
+
+static void sd_file_write_error(sd_file_t *sd_file) {
+    sd_file->write_errors++;
+    IO_LED_R_SetLow();
+    if (sd_file->write_errors > SD_FILE_MAX_WRITE_ERRORS) {
+        asm("reset");
+    }
+}
+
+// Returns the free bytes for data in the active buffer
+static uint16_t sd_file_space(sd_file_t *sd_file) {
+    uint16_t data_size = SD_FILE_SECTOR_SIZE - (sd_file->trailer ? SD_FILE_TRAILER_SIZE : 0);
+    
+    return (sd_file->buffer_fill < data_size) ? data_size - sd_file->buffer_fill : 0;
+}
+
+// Returns 1 when the next sector goes directly to the card
+static uint8_t sd_file_is_direct(sd_file_t *sd_file) {
+    return sd_file->first_sector != 0 && sd_file->sectors_written < sd_file->reserved_sectors;
+}
+
+// Sets the file size FILEIO writes to the directory entry on the next flush or close
+static void sd_file_set_size(sd_file_t *sd_file) {
+    sd_file->file->size = sd_file->sectors_written * SD_FILE_SECTOR_SIZE + sd_file->buffer_fill;
+}
+
+// Returns the number of sectors in the contiguous clusters at the start of the file.
+// The FAT is followed until at least limit sectors are found.
+static uint32_t sd_file_contiguous_sectors(FILEIO_OBJECT *file, uint32_t limit) {
+    FILEIO_DRIVE *disk = (FILEIO_DRIVE *)file->disk;
+    uint32_t cluster = file->firstCluster;
+    uint32_t first_sector = FILEIO_ClusterToSector(disk, cluster);
+    
+    while (FILEIO_ClusterToSector(disk, cluster + 1) - first_sector < limit &&
+            FILEIO_FATRead(disk, cluster) == cluster + 1) {
+        cluster++;
+    }
+    return FILEIO_ClusterToSector(disk, cluster + 1) - first_sector;
+}
+
+// Checks if the clusters allocated for the next file form one contiguous block.
+// Afterwards the file size is set back to 0 so writing starts at the beginning.
+static void sd_file_preallocate_check(sd_file_t *sd_file) {
+    FILEIO_OBJECT *file = sd_file->next;
+    uint32_t sectors = sd_file->next_reserved_sectors;
+    
+    if (sectors == 0) {
+        return;
+    }
+    FILEIO_Flush(file);
+    
+    if (sd_file->next_sectors_done == sectors) {
+        if (sd_file_contiguous_sectors(file, sectors) >= sectors) {
+            sd_file->next_first_sector = FILEIO_ClusterToSector((FILEIO_DRIVE *)file->disk, file->firstCluster);
+        } else {
+            debugprint_string("Log file is not contiguous\r\n");
+        }
+    }
+    if (sd_file->next_first_sector == 0) {
+        sd_file->next_reserved_sectors = 0;
+    }
+    
+    // Start writing at the beginning again. The clusters stay allocated.
+    file->size = 0;
+    FILEIO_Seek(file, 0, FILEIO_SEEK_SET);
+    FILEIO_Flush(file);
+}
+
+// Writes the active buffer as the next sector of the file and switches to the other buffer.
+// A sector of the reserved area is sent by DMA and still in flight on return. Waiting
+// for the previous sector first makes sure the other buffer is free to be filled.
+static int8_t sd_file_write_sector(sd_file_t *sd_file) {
+    const uint8_t *data = sd_file->buffer[sd_file->active];
+    int8_t res = 0;
+    
+    if (sd_file_is_direct(sd_file)) {
+        // A failed sector can not be written again, the buffer is already reused.
+        res = sd_stream_write(sd_file->first_sector + sd_file->sectors_written, data);
+        sd_file->sectors_written++;
+        
+        // Used up the reserved sectors, continue after them through FILEIO
+        if (!sd_file_is_direct(sd_file)) {
+            if (sd_stream_close() != 0) {
+                res = -1;
+            }
+            sd_file->file->size = sd_file->sectors_written * SD_FILE_SECTOR_SIZE;
+            FILEIO_Seek(sd_file->file, 0, FILEIO_SEEK_END);
+        }
+    } else {
+        if (sd_stream_close() != 0) {
+            res = -1;
+        }
+        if (FILEIO_Write(data, SD_FILE_SECTOR_SIZE, 1, sd_file->file) != 1) {
+            // Keep the sector, it is written again with the next data
+            return -1;
+        }
+        sd_file->sectors_written++;
+    }
+    sd_file->active ^= 1;
+    sd_file->buffer_fill = 0;
+    return res;
+}
+
+void sd_file_init(FILEIO_SD_DRIVE_CONFIG *media) {
+    sd_file_media = media;
+    if (sd_stream_init(media) != 0) {
+        debugprint_string("Multi block writes not available\r\n");
+    }
+}
+
+void sd_file_tasks(void) {
+    sd_stream_tasks();
+}
+
+// Closes a next file that was not switched to. It is left empty.
+static void sd_file_drop_next(sd_file_t *sd_file) {
+    if (sd_file->next_state != SD_FILE_NEXT_NONE) {
+        sd_stream_close();
+        sd_file->next->size = 0;
+        FILEIO_Close(sd_file->next);
+        sd_file->next_state = SD_FILE_NEXT_NONE;
+    }
+}
+
+static int8_t sd_file_close_current(sd_file_t *sd_file) {
+    int8_t res;
+    
+    if (!sd_file->is_open) {
+        return -1;
+    }
+    
+    // Write the remaining data and set the real file size.
+    // The partial sector is at the end of the file, no need to seek back in the FILEIO case.
+    res = sd_file_flush(sd_file);
+    sd_file->buffer_fill = 0;
+    if (FILEIO_Close(sd_file->file) != FILEIO_RESULT_SUCCESS) {
+        res = -1;
+    }
+    sd_file->is_open = 0;
+    return res;
+}
+
+int8_t sd_file_open(sd_file_t *sd_file, const char *file_name, uint32_t preallocate) {
+    if (sd_file_prepare(sd_file, file_name, preallocate) != 0) {
+        return -1;
+    }
+    sd_file_switch(sd_file);
+    return 0;
+}
+
+int8_t sd_file_prepare(sd_file_t *sd_file, const char *file_name, uint32_t preallocate) {
+    sd_file_drop_next(sd_file);
+    sd_file->next = (sd_file->file == &sd_file->files[0]) ? &sd_file->files[1] : &sd_file->files[0];
+    sd_file->next_first_sector = 0;
+    sd_file->next_reserved_sectors = 0;
+    sd_file->next_sectors_done = 0;
+    
+    sd_stream_close();
+    if (FILEIO_Open(sd_file->next, file_name, FILEIO_OPEN_WRITE | FILEIO_OPEN_APPEND | FILEIO_OPEN_CREATE) != FILEIO_RESULT_SUCCESS) {
+        debugprint_string("Failed to open ");
+        debugprint_string((char *)file_name);
+        debugprint_string("\r\n");
+        sd_file_write_error(sd_file);
+        return -1;
+    }
+    
+    // Only a new file can be pre-allocated
+    if (sd_file->next->size == 0 && sd_file_media != 0) {
+        sd_file->next_reserved_sectors = preallocate;
+    }
+    sd_file->next_state = SD_FILE_NEXT_PREPARING;
+    return 0;
+}
+
+int8_t sd_file_prepare_step(sd_file_t *sd_file) {
+    uint8_t batch = 0;
+    
+    if (sd_file->next_state != SD_FILE_NEXT_PREPARING) {
+        return sd_file->next_state == SD_FILE_NEXT_READY ? 1 : -1;
+    }
+    
+    if (sd_file->next_sectors_done < sd_file->next_reserved_sectors) {
+        // Wait for an idle stream instead of blocking in sd_stream_close()
+        sd_stream_tasks();
+        if (sd_stream_is_busy()) {
+            return 0;
+        }
+        sd_stream_close();
+        while (sd_file->next_sectors_done < sd_file->next_reserved_sectors && batch < SD_FILE_PREPARE_BATCH) {
+            if (FILEIO_Write(sd_file_empty_sector, 1, SD_FILE_SECTOR_SIZE, sd_file->next) != SD_FILE_SECTOR_SIZE) {
+                break;
+            }
+            sd_file->next_sectors_done++;
+            batch++;
+        }
+        if (batch == SD_FILE_PREPARE_BATCH) {
+            return 0;
+        }
+    }
+    sd_file_preallocate_check(sd_file);
+    sd_file->next_state = SD_FILE_NEXT_READY;
+    return 1;
+}
+
+uint8_t sd_file_is_preparing(sd_file_t *sd_file) {
+    return sd_file->next_state == SD_FILE_NEXT_PREPARING;
+}
+
+int8_t sd_file_switch(sd_file_t *sd_file) {
+    int8_t res = 0;
+    
+    // Finish the preparation when the file is needed early
+    while (sd_file_prepare_step(sd_file) == 0);
+    
+    if (sd_file->is_open) {
+        res = sd_file_close_current(sd_file);
+    }
+    if (sd_file->next_state == SD_FILE_NEXT_NONE) {
+        return -1;
+    }
+    sd_file->file = sd_file->next;
+    sd_file->first_sector = sd_file->next_first_sector;
+    sd_file->reserved_sectors = sd_file->next_reserved_sectors;
+    sd_file->next_state = SD_FILE_NEXT_NONE;
+    sd_file->active = 0;
+    sd_file->buffer_fill = 0;
+    sd_file->sectors_written = 0;
+    sd_file->is_open = 1;
+    return res;
+}
+
+// Ends the full active buffer with the block sequence number and the CRC of the sector
+static void sd_file_add_trailer(sd_file_t *sd_file) {
+    uint8_t *trailer = &sd_file->buffer[sd_file->active][SD_FILE_SECTOR_SIZE - SD_FILE_TRAILER_SIZE];
+    uint16_t crc;
+    
+    trailer[0] = sd_file->block_sequence & 0xFF;
+    trailer[1] = (sd_file->block_sequence >> 8) & 0xFF;
+    trailer[2] = (sd_file->block_sequence >> 16) & 0xFF;
+    trailer[3] = sd_file->block_sequence >> 24;
+    crc = utl_calc_crc(sd_file->buffer[sd_file->active], SD_FILE_SECTOR_SIZE - 2);
+    trailer[4] = crc & 0xFF;
+    trailer[5] = crc >> 8;
+    sd_file->block_sequence++;
+    sd_file->buffer_fill = SD_FILE_SECTOR_SIZE;
+}
+
+// Writes the active buffer when it is full. A sector that failed is tried again.
+static int8_t sd_file_sector_done(sd_file_t *sd_file) {
+    if (sd_file->trailer && sd_file->buffer_fill == SD_FILE_SECTOR_SIZE - SD_FILE_TRAILER_SIZE) {
+        sd_file_add_trailer(sd_file);
+    }
+    if (sd_file->buffer_fill == SD_FILE_SECTOR_SIZE) {
+        if (sd_file_write_sector(sd_file) != 0) {
+            sd_file_write_error(sd_file);
+            return -1;
+        }
+        sd_file->write_errors = 0;
+    }
+    return 0;
+}
+
+int8_t sd_file_write(sd_file_t *sd_file, const void *data, uint16_t length) {
+    const uint8_t *src = data;
+    uint16_t chunk;
+    
+    if (!sd_file->is_open) {
+        return -1;
+    }
+    
+    while (length != 0) {
+        // Copy as much as fits in the sector
+        chunk = sd_file_space(sd_file);
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(&sd_file->buffer[sd_file->active][sd_file->buffer_fill], src, chunk);
+        sd_file->buffer_fill += chunk;
+        src += chunk;
+        length -= chunk;
+        
+        // Write the sector when it is full
+        if (sd_file_sector_done(sd_file) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void sd_file_set_trailer(sd_file_t *sd_file, uint8_t enable) {
+    sd_file->trailer = enable;
+}
+
+char *sd_file_cursor(sd_file_t *sd_file, uint16_t *space) {
+    if (!sd_file->is_open) {
+        *space = 0;
+        return 0;
+    }
+    *space = sd_file_space(sd_file);
+    return (char *)&sd_file->buffer[sd_file->active][sd_file->buffer_fill];
+}
+
+int8_t sd_file_commit(sd_file_t *sd_file, uint16_t length) {
+    if (!sd_file->is_open || length > sd_file_space(sd_file)) {
+        return -1;
+    }
+    sd_file->buffer_fill += length;
+    return sd_file_sector_done(sd_file);
+}
+
+int8_t sd_file_pad_sector(sd_file_t *sd_file, uint8_t fill) {
+    if (!sd_file->is_open) {
+        return -1;
+    }
+    if (sd_file->buffer_fill == 0) {
+        return 0;
+    }
+    
+    memset(&sd_file->buffer[sd_file->active][sd_file->buffer_fill], fill, sd_file_space(sd_file));
+    sd_file->buffer_fill += sd_file_space(sd_file);
+    return sd_file_sector_done(sd_file);
+}
+
+uint32_t sd_file_size(sd_file_t *sd_file) {
+    return sd_file->sectors_written * SD_FILE_SECTOR_SIZE + sd_file->buffer_fill;
+}
+
+int8_t sd_file_flush(sd_file_t *sd_file) {
+    int8_t res = 0;
+    
+    if (!sd_file->is_open) {
+        return -1;
+    }
+    
+    // The sector in flight has to be on the card before FILEIO can be used.
+    // A lost sector does not stop the rest of the file from being committed.
+    if (sd_stream_close() != 0) {
+        sd_file_write_error(sd_file);
+        res = -1;
+    }
+    
+    if (sd_file_is_direct(sd_file)) {
+        // Write the partial sector in place, it is written again once it is complete.
+        // Only the directory entry needs to be updated by FILEIO.
+        if (sd_file->buffer_fill != 0) {
+            memset(&sd_file->buffer[sd_file->active][sd_file->buffer_fill], 0, SD_FILE_SECTOR_SIZE - sd_file->buffer_fill);
+            if (!FILEIO_SD_SectorWrite(sd_file_media, sd_file->first_sector + sd_file->sectors_written, sd_file->buffer[sd_file->active], false)) {
+                sd_file_write_error(sd_file);
+                return -1;
+            }
+        }
+        sd_file_set_size(sd_file);
+    } else if (sd_file->buffer_fill != 0) {
+        // Write the partial sector and go back to the start of it.
+        // It is written again as a whole once it is complete.
+        if (FILEIO_Write(sd_file->buffer[sd_file->active], 1, sd_file->buffer_fill, sd_file->file) != sd_file->buffer_fill) {
+            sd_file_write_error(sd_file);
+            return -1;
+        }
+        FILEIO_Seek(sd_file->file, -(int32_t)sd_file->buffer_fill, FILEIO_SEEK_CUR);
+    }
+    // Write the cached sector and directory entry to the card
+    if (FILEIO_Flush(sd_file->file) != FILEIO_RESULT_SUCCESS) {
+        sd_file_write_error(sd_file);
+        return -1;
+    }
+    if (res == 0) {
+        sd_file->write_errors = 0;
+    }
+    return res;
+}
+
+// Reads a sector into the buffer and returns the number of bytes up to the last non-zero one
+static uint16_t sd_file_sector_used(uint32_t sector, uint8_t *buffer) {
+    uint16_t used = SD_FILE_SECTOR_SIZE;
+    
+    if (!FILEIO_SD_SectorRead(sd_file_media, sector, buffer)) {
+        return 0;
+    }
+    while (used != 0 && buffer[used - 1] == 0) {
+        used--;
+    }
+    return used;
+}
+
+int8_t sd_file_recover(sd_file_t *sd_file, const char *file_name, uint16_t record_size, uint32_t reserved_sectors) {
+    FILEIO_OBJECT *file = &sd_file->files[0];
+    uint32_t first_sector, low, high, middle, size, recorded_size;
+    
+    if (sd_file->is_open || sd_file->next_state != SD_FILE_NEXT_NONE || sd_file_media == 0) {
+        return -1;
+    }
+    if (FILEIO_Open(file, file_name, FILEIO_OPEN_READ) != FILEIO_RESULT_SUCCESS) {
+        return -1;
+    }
+    recorded_size = file->size;
+    if (file->firstCluster == 0 || reserved_sectors == 0) {
+        FILEIO_Close(file);
+        return 0;
+    }
+    
+    // The sectors in use come first. Search the first empty one after the recorded size.
+    // Past the reserved sectors the clusters were not zero-filled.
+    first_sector = FILEIO_ClusterToSector((FILEIO_DRIVE *)file->disk, file->firstCluster);
+    low = recorded_size / SD_FILE_SECTOR_SIZE;
+    high = sd_file_contiguous_sectors(file, reserved_sectors);
+    if (high > reserved_sectors) {
+        high = reserved_sectors;
+    }
+    if (low >= high) {
+        FILEIO_Close(file);
+        return 0;
+    }
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (sd_file_sector_used(first_sector + middle, sd_file->buffer[0]) != 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    size = 0;
+    
+    // The data ends at the last non-zero byte, completed to a whole record if that
+    // record was written. Zero bytes at the end of the data are part of the record.
+    if (low != 0) {
+        size = (low - 1) * SD_FILE_SECTOR_SIZE + sd_file_sector_used(first_sector + low - 1, sd_file->buffer[0]);
+        if ((size + record_size - 1) / record_size * record_size <= low * SD_FILE_SECTOR_SIZE) {
+            size = (size + record_size - 1) / record_size * record_size;
+        } else {
+            size = size / record_size * record_size;
+        }
+    }
+    FILEIO_Close(file);
+    if (size <= recorded_size) {
+        return 0;
+    }
+    
+    if (FILEIO_Open(file, file_name, FILEIO_OPEN_WRITE) != FILEIO_RESULT_SUCCESS) {
+        return -1;
+    }
+    file->size = size;
+    if (FILEIO_Close(file) != FILEIO_RESULT_SUCCESS) {
+        return -1;
+    }
+    return 1;
+}
+
+int8_t sd_file_close(sd_file_t *sd_file) {
+    sd_file_drop_next(sd_file);
+    return sd_file_close_current(sd_file);
+}
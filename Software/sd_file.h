@@ -0,0 +1,189 @@
+/* 
+ * File:                sd_file.h
+ * Comments:            Buffered log file writer on top of the MLA FILEIO library.
+ *                      The file stays open while logging and data is handed to
+ *                      FILEIO in whole 512 byte sectors.
+ *                      A file can be pre-allocated as one contiguous block of
+ *                      sectors. Those sectors are then written directly to the
+ *                      card without any FAT or directory updates, one multi
+ *                      block write for consecutive sectors. The two sector
+ *                      buffers take turns: one is filled while DMA sends the other.
+ *                      The next file can be created and pre-allocated in small
+ *                      steps while the current one is still written.
+ *                      FILEIO only allocates clusters by writing them, so
+ *                      pre-allocating writes zeros to every reserved sector and
+ *                      each log sector ends up written twice. This doubles the
+ *                      write volume and the wear of the area. It is accepted
+ *                      because the zeros are what sd_file_recover() needs to
+ *                      find the end of the data after a power loss, and the
+ *                      zeros are written in the background ahead of time.
+ *                      Files opened with preallocate 0 are written once.
+ */
+
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef SD_FILE_H
+#define	SD_FILE_H
+
+#include <stdint.h>
+#include "mla_fileio/fileio.h"
+#include "mla_fileio/sd_spi.h"
+
+#define SD_FILE_SECTOR_SIZE     512
+#define SD_FILE_BUFFERS         2       // Ping-pong sector buffers per file
+#define SD_FILE_TRAILER_SIZE    6       // Block sequence number and CRC, see sd_file_set_trailer()
+#define SD_FILE_PREPARE_BATCH   8       // Sectors pre-allocated per sd_file_prepare_step()
+
+typedef struct {
+    FILEIO_OBJECT files[2];         // The open file and the next one
+    FILEIO_OBJECT *file;            // The open file
+    FILEIO_OBJECT *next;            // The file being prepared
+    uint8_t buffer[SD_FILE_BUFFERS][SD_FILE_SECTOR_SIZE];
+    uint8_t active;                 // Buffer being filled, the other one may still be written
+    uint16_t buffer_fill;           // Bytes in the active buffer
+    uint32_t sectors_written;       // Complete sectors written to the card
+    uint32_t first_sector;          // First sector of the pre-allocated area, 0 when not pre-allocated
+    uint32_t reserved_sectors;      // Size of the pre-allocated area
+    uint32_t next_first_sector;     // Pre-allocated area of the next file
+    uint32_t next_reserved_sectors;
+    uint32_t next_sectors_done;     // Sectors of the next file allocated so far
+    uint8_t next_state;
+    uint32_t block_sequence;        // Number of the next sector with a trailer
+    uint8_t trailer;
+    uint8_t is_open;
+    uint8_t write_errors;
+} sd_file_t;
+
+// Sets the sd card used for the direct sector writes.
+// Needs to be called after FILEIO mounted the card.
+// Parameters:
+//  *media          The media parameters also given to FILEIO
+void sd_file_init(FILEIO_SD_DRIVE_CONFIG *media);
+
+// Continues the sector write in progress. Call from the main loop.
+void sd_file_tasks(void);
+
+// Opens (and creates if needed) a file for appending and keeps it open.
+// Parameters:
+//  *sd_file        The file object to use
+//  *file_name      Name of the file in 8.3 format
+//  preallocate     Number of sectors to reserve for a new file. 0 to append with FILEIO only.
+//                  When the file does not end up contiguous on the card or the reserved
+//                  sectors are used up, writing continues through FILEIO.
+// Returns:
+//  0 on success, -1 if the file could not be opened.
+int8_t sd_file_open(sd_file_t *sd_file, const char *file_name, uint32_t preallocate);
+
+// Opens the next file without switching to it. The sectors are pre-allocated
+// by sd_file_prepare_step(), see sd_file_open() for the parameters.
+// A next file that was prepared before but not used is closed empty.
+// Returns:
+//  0 on success, -1 if the file could not be opened.
+int8_t sd_file_prepare(sd_file_t *sd_file, const char *file_name, uint32_t preallocate);
+
+// Pre-allocates the next SD_FILE_PREPARE_BATCH sectors of the next file.
+// FILEIO needs the card, so the open stream is closed once per batch. Nothing
+// is done while a sector of the stream is still in flight.
+// Parameters:
+//  *sd_file        The file object
+// Returns:
+//  1 when the next file is ready, 0 when more steps are needed, -1 if no file is prepared.
+int8_t sd_file_prepare_step(sd_file_t *sd_file);
+
+// Returns 1 while the next file still has sectors to pre-allocate, so
+// sd_file_switch() would have to finish them first.
+// Parameters:
+//  *sd_file        The file object
+uint8_t sd_file_is_preparing(sd_file_t *sd_file);
+
+// Closes the open file and continues with the prepared one. A preparation that
+// is not done yet is finished first. Without a prepared file the open file is
+// only closed.
+// Parameters:
+//  *sd_file        The file object
+// Returns:
+//  0 on success, -1 if no file was prepared or closing the open file failed.
+int8_t sd_file_switch(sd_file_t *sd_file);
+
+// Adds data to the sector buffer. Each time a sector is full it is written to
+// the card and the other buffer is filled next.
+// Parameters:
+//  *sd_file        The file object to write to
+//  *data           Pointer to the data
+//  length          Number of bytes to write
+// Returns:
+//  0 on success, -1 if the file is not open or the write failed.
+int8_t sd_file_write(sd_file_t *sd_file, const void *data, uint16_t length);
+
+// Ends every complete sector with a trailer, so the data of each sector is
+// SD_FILE_TRAILER_SIZE bytes shorter. The trailer holds the block sequence number
+// (uint32_t), counting on over all files written with this object, and the CRC 16
+// CCITT from utl_calc_crc() of the sector up to the CRC. Both little endian.
+// A partial sector written by a flush has no trailer until it is complete.
+// Parameters:
+//  *sd_file        The file object
+//  enable          1 to add trailers to the sectors completed from now on
+void sd_file_set_trailer(sd_file_t *sd_file, uint8_t enable);
+
+// Returns the write position in the sector buffer, so data can be formatted in place
+// instead of being copied by sd_file_write(). Add it to the file with sd_file_commit().
+// Parameters:
+//  *sd_file        The file object to write to
+//  *space          Set to the number of bytes that fit before the end of the sector data
+// Returns:
+//  The write position, 0 with space 0 if the file is not open.
+char *sd_file_cursor(sd_file_t *sd_file, uint16_t *space);
+
+// Adds the bytes placed at sd_file_cursor() to the file.
+// Parameters:
+//  *sd_file        The file object to write to
+//  length          Number of bytes placed, at most the space returned by sd_file_cursor()
+// Returns:
+//  0 on success, -1 if the file is not open, length is too large or the write failed.
+int8_t sd_file_commit(sd_file_t *sd_file, uint16_t length);
+
+// Fills the rest of the current sector so the next data starts at a sector boundary.
+// With trailers only the data part is filled.
+// Parameters:
+//  *sd_file        The file object to write to
+//  fill            The byte to fill with
+// Returns:
+//  0 on success, -1 if the file is not open or the write failed.
+int8_t sd_file_pad_sector(sd_file_t *sd_file, uint8_t fill);
+
+// Returns the number of bytes written to the file, including the buffered ones.
+// Parameters:
+//  *sd_file        The file object
+uint32_t sd_file_size(sd_file_t *sd_file);
+
+// Commits the sector in flight, the partially filled sector and the file size in the directory entry to the card.
+// The partial sector stays in the buffer so the file remains sector aligned.
+// Parameters:
+//  *sd_file        The file object to flush
+// Returns:
+//  0 on success, -1 if the file is not open or the write failed.
+int8_t sd_file_flush(sd_file_t *sd_file);
+
+// Sets the size of a file that was not closed properly to include the data
+// written after the last flush. Only the pre-allocated sectors of sd_file_open()
+// are searched, as they were zero before the data was written to them in order.
+// Sectors appended through FILEIO may still hold data of deleted files.
+// Parameters:
+//  *sd_file        A closed file object, its buffer and file object are used
+//  *file_name      Name of the file in 8.3 format
+//  record_size     The size is rounded to whole records, 1 for any size
+//  reserved_sectors    Pre-allocated sectors of the file, 0 when it was not pre-allocated
+// Returns:
+//  1 when data was recovered, 0 when the size was correct, -1 on errors.
+int8_t sd_file_recover(sd_file_t *sd_file, const char *file_name, uint16_t record_size, uint32_t reserved_sectors);
+
+// Flushes and closes the file. The size of a pre-allocated file is set to the
+// amount of data written. A prepared next file is closed empty.
+// Parameters:
+//  *sd_file        The file object to close
+// Returns:
+//  0 on success, -1 if the file was not open or the flush failed.
+int8_t sd_file_close(sd_file_t *sd_file);
+
+#endif	/* SD_FILE_H */
+
@@ -8,14 +8,18 @@
 #include <xc.h>
 #include <stdint.h>
 #include "sd_logger.h"
+#include "sd_file.h"
+#include "sd_stream.h"
 #include "mla_fileio/fileio.h"
 #include "mla_fileio/sd_spi.h"
 #include "debugprint.h"
 #include "softwaretimer.h"
 #include <string.h>
 #include "utl.h"
-#include "gps.h"
 #include "mcc_generated_files/pin_manager.h"
+#include "can_capture.h"
+#include "log_format.h"
+#include "log_row.h"
 #include "canbus.h"
 
 // ********************************************************
@@ -135,6 +139,7 @@ static int8_t sd_logger_fileio_init(void) {
     error = FILEIO_DriveMount('A', &gSdDrive, &sdCardMediaParameters);
     if (error == FILEIO_ERROR_NONE) {
         debugprint_string("Successfully mounted the drive\r\n");
+        sd_file_init(&sdCardMediaParameters);
         return 0;
     } else {
         debugprint_string("Error mounting drive\r\n");
@@ -149,58 +154,410 @@ static int8_t sd_logger_fileio_init(void) {
 // * LOGGING
 // ********************************************************
 
+#define SD_LOGGER_DIRECTORY     "LOGS"          // Holds a directory per session
+#define SD_LOGGER_STATE_FILE    "STATE.DAT"     // Number of the last session, in SD_LOGGER_DIRECTORY
+#define SD_LOGGER_NO_LAYOUT     0xFF            // sd_logger_node_count before the first layout
+
+// Files of the session in the state file
+#define SD_LOGGER_STATE_LOG     0
+#define SD_LOGGER_STATE_CAPTURE 1
+#define SD_LOGGER_STATE_FILES   2
+
+// Contents of the state file. The files that are open in the session are added with their
+// pre-allocated sectors. Only those sectors were zero-filled and can be searched when the
+// session ended without closing the files.
+typedef struct {
+    uint16_t session;
+    uint16_t session_check;                             // Complement of the session number
+    char names[SD_LOGGER_STATE_FILES][13];              // Empty when no file was opened
+    uint32_t reserved_sectors[SD_LOGGER_STATE_FILES];
+} sd_logger_state_t;
+
 static uint8_t timer_sd_logger = SOFTWARETIMER_NONE;
-static uint8_t sd_logger_file_number = 0;
+static uint16_t sd_logger_session = 0;
+static uint16_t sd_logger_file_number = 0;
+static uint16_t sd_logger_next_file_number = 0;
+static uint16_t sd_logger_trigger_number = 0;   // Number of the next TRIGn.CAN file
 static uint8_t sd_logger_file_new = 0;
+static uint8_t sd_logger_next_prepared = 0;     // The files with sd_logger_next_file_number are open
+static uint8_t sd_logger_session_open = 0;      // Files are written to the session directory
+static sd_logger_state_t sd_logger_state;
+static uint8_t sd_logger_rate_hz = SD_LOGGER_RATE_HZ;
+static uint8_t sd_logger_group_rates_hz[LOG_ROW_GROUPS] = SD_LOGGER_GROUP_RATES_HZ;
+static uint32_t sd_logger_row_counter = 0;      // Rows in the current file
+static uint32_t sd_logger_file_start_ms = 0;    // Time of the first row in the current file
+static uint8_t sd_logger_node_count = SD_LOGGER_NO_LAYOUT;     // Nodes in the column layout
+static uint8_t sd_logger_previous_record[LOG_ROW_RECORD_SIZE];  // Base for the delta encoding
+static sd_file_t sd_logger_file;
+static sd_file_t sd_logger_capture_file;
 
+#if SD_LOGGER_BINARY
+#define SD_LOGGER_EXTENSION     ".BIN"
+#else
+#define SD_LOGGER_EXTENSION     ".CSV"
+#endif
 
-static void sd_logger_find_free_file_number(void) {
-    uint8_t i;
-    char file_name[13];
+
+static void sd_logger_file_name(const char *prefix, uint16_t file_number, const char *extension, char *file_name) {
     char temp[8];
+    
+    strcpy(file_name, prefix);
+    utl_uint32_to_string(file_number, temp, 10);
+    strcat(file_name, temp);
+    strcat(file_name, extension);
+}
+
+static void sd_logger_session_name(uint16_t session, char *name) {
+    strcpy(name, "S");
+    utl_uint32_to_string(session, &name[1], 10);
+}
+
+// Returns the highest number in the names matching the pattern in one pass over the
+// current directory. The number follows the first prefix_length characters.
+// Returns -1 when nothing matches.
+static int32_t sd_logger_find_highest(const char *pattern, uint8_t prefix_length, uint8_t attributes) {
+    FILEIO_SEARCH_RECORD record;
+    int32_t highest = -1;
+    int32_t number;
+    char *c;
+    
+    if (FILEIO_Find(pattern, attributes, &record, true) != FILEIO_RESULT_SUCCESS) {
+        return -1;
+    }
+    do {
+        c = &record.shortFileName[prefix_length];
+        if ((record.attributes ^ attributes) & FILEIO_ATTRIBUTE_DIRECTORY || *c < '0' || *c > '9') {
+            continue;
+        }
+        number = 0;
+        while (*c >= '0' && *c <= '9') {
+            number = number * 10 + (*c++ - '0');
+        }
+        if (number > highest) {
+            highest = number;
+        }
+    } while (FILEIO_Find(pattern, attributes, &record, false) == FILEIO_RESULT_SUCCESS);
+    return highest;
+}
+
+static void sd_logger_clear_open_files(void) {
+    memset(sd_logger_state.names, 0, sizeof(sd_logger_state.names));
+    memset(sd_logger_state.reserved_sectors, 0, sizeof(sd_logger_state.reserved_sectors));
+}
+
+// Reads the state file into sd_logger_state. An older state file without the open
+// files is still valid, none of its files are then recovered.
+// Returns the last session number, -1 if there is no valid state file.
+static int32_t sd_logger_read_state(void) {
     FILEIO_OBJECT file;
+    size_t count;
+    
+    if (FILEIO_Open(&file, SD_LOGGER_STATE_FILE, FILEIO_OPEN_READ) != FILEIO_RESULT_SUCCESS) {
+        return -1;
+    }
+    count = FILEIO_Read(&sd_logger_state, 1, sizeof(sd_logger_state), &file);
+    FILEIO_Close(&file);
+    if (count != sizeof(sd_logger_state)) {
+        sd_logger_clear_open_files();
+    }
+    if (count < 2 * sizeof(uint16_t) || sd_logger_state.session != (uint16_t)~sd_logger_state.session_check) {
+        return -1;
+    }
+    return sd_logger_state.session;
+}
+
+// Writes sd_logger_state to the state file in the current directory
+static void sd_logger_write_state(void) {
+    FILEIO_OBJECT file;
+    
+    sd_logger_state.session = sd_logger_session;
+    sd_logger_state.session_check = ~sd_logger_session;
+    if (FILEIO_Open(&file, SD_LOGGER_STATE_FILE, FILEIO_OPEN_WRITE | FILEIO_OPEN_CREATE | FILEIO_OPEN_TRUNCATE) != FILEIO_RESULT_SUCCESS) {
+        debugprint_string("Failed to write log state\r\n");
+        return;
+    }
+    FILEIO_Write(&sd_logger_state, sizeof(sd_logger_state), 1, &file);
+    FILEIO_Close(&file);
+}
+
+// Sets a file that was just opened and its pre-allocated sectors in sd_logger_state
+static void sd_logger_set_open_file(uint8_t index, const char *file_name, sd_file_t *sd_file) {
+    strcpy(sd_logger_state.names[index], file_name);
+    sd_logger_state.reserved_sectors[index] = sd_file->reserved_sectors;
+}
+
+// Writes the open files to the state file while logging to the session directory
+static void sd_logger_save_open_files(void) {
+    char name[13];
+    
+    if (!sd_logger_session_open) {
+        return;
+    }
+    // The state file is one directory up and FILEIO needs the card
+    sd_stream_close();
+    sd_logger_session_name(sd_logger_session, name);
+    FILEIO_DirectoryChange("..");
+    sd_logger_write_state();
+    FILEIO_DirectoryChange(name);
+}
+
+// Sets the size of the files of a session that ended without closing them, like
+// after a power loss. The data written after the last flush is added to the files
+// that were open according to the state file. Empty files, prepared for a rotation
+// that did not happen, are removed.
+static void sd_logger_recover_session(uint16_t session) {
+    FILEIO_SEARCH_RECORD record;
+    char name[13];
+    uint16_t record_size;
+    uint32_t reserved_sectors;
+    uint8_t i;
+    int8_t result;
+    
+    sd_logger_session_name(session, name);
+    if (FILEIO_DirectoryChange(name) != FILEIO_RESULT_SUCCESS) {
+        return;
+    }
+    // The log files and the LOGn.CAN and TRIGn.CAN capture files
+    if (FILEIO_Find("*.*", FILEIO_ATTRIBUTE_ARCHIVE, &record, true) == FILEIO_RESULT_SUCCESS) {
+        do {
+            // Capture files hold whole records and binary log files whole blocks. The
+            // records of a block can end in zero bytes, so the block is kept whole.
+            // Csv text has no zero bytes and is cut where it ends.
+            if (strstr(record.shortFileName, ".CAN")) {
+                record_size = sizeof(can_capture_record_t);
+            } else if (strstr(record.shortFileName, ".BIN")) {
+                record_size = LOG_FORMAT_BLOCK_SIZE;
+            } else {
+                record_size = 1;
+            }
+            reserved_sectors = 0;
+            for (i = 0; i < SD_LOGGER_STATE_FILES; i++) {
+                if (strcmp(record.shortFileName, sd_logger_state.names[i]) == 0) {
+                    reserved_sectors = sd_logger_state.reserved_sectors[i];
+                }
+            }
+            result = sd_file_recover(&sd_logger_file, record.shortFileName, record_size, reserved_sectors);
+            if (result == 1) {
+                debugprint_string("Recovered ");
+                debugprint_string(name);
+                debugprint_string("\\");
+                debugprint_string(record.shortFileName);
+                debugprint_string("\r\n");
+            } else if (result == 0 && record.fileSize == 0) {
+                FILEIO_Remove(record.shortFileName);
+            }
+        } while (FILEIO_Find("*.*", FILEIO_ATTRIBUTE_ARCHIVE, &record, false) == FILEIO_RESULT_SUCCESS);
+    }
+    FILEIO_DirectoryChange("..");
+}
+
+// Removes a session directory with all its files
+static void sd_logger_remove_session(uint16_t session) {
+    FILEIO_SEARCH_RECORD record;
+    char name[13];
     
-    // find next free number in filename
-    for (i=0; i<254; i++) {
-        strcpy(file_name, "LOG");
-        utl_uint32_to_string(i, temp, 10);
-        strcat(file_name, temp);
-        strcat(file_name, ".CSV");
-        // Try to open file
-        if (FILEIO_Open(&file, file_name, FILEIO_OPEN_READ) != FILEIO_RESULT_SUCCESS) {
-            // Could not open file. Means the file is not yet there and we can use this number.
+    sd_logger_session_name(session, name);
+    if (FILEIO_DirectoryChange(name) != FILEIO_RESULT_SUCCESS) {
+        return;
+    }
+    // A removed file changes the directory, so each search starts over
+    while (FILEIO_Find("*.*", FILEIO_ATTRIBUTE_ARCHIVE, &record, true) == FILEIO_RESULT_SUCCESS) {
+        if (FILEIO_Remove(record.shortFileName) != FILEIO_RESULT_SUCCESS) {
             break;
         }
-        FILEIO_Close (&file);
     }
+    FILEIO_DirectoryChange("..");
+    FILEIO_DirectoryRemove(name);
+}
+
+// Creates a new directory for the files of this session and makes it the current
+// directory. The session number follows the one in the state file. Only when the
+// state file is missing or out of date the session directories are searched.
+// The files of the previous session are recovered first. The session
+// SD_LOGGER_MAX_SESSIONS before the new one is removed, so the number of
+// directories to look through stays limited.
+static int8_t sd_logger_start_session(void) {
+    FILEIO_SEARCH_RECORD record;
+    char name[13];
+    int32_t last;
     
-    sd_logger_file_number = i;
+    if (FILEIO_DirectoryChange(SD_LOGGER_DIRECTORY) != FILEIO_RESULT_SUCCESS) {
+        if (FILEIO_DirectoryMake(SD_LOGGER_DIRECTORY) != FILEIO_RESULT_SUCCESS ||
+                FILEIO_DirectoryChange(SD_LOGGER_DIRECTORY) != FILEIO_RESULT_SUCCESS) {
+            return -1;
+        }
+    }
+    
+    last = sd_logger_read_state();
+    if (last >= 0) {
+        sd_logger_session_name(last + 1, name);
+        if (FILEIO_Find(name, FILEIO_ATTRIBUTE_DIRECTORY, &record, true) == FILEIO_RESULT_SUCCESS) {
+            last = -1;
+        }
+    }
+    if (last < 0) {
+        // The open files in the state file belong to another session
+        sd_logger_clear_open_files();
+        last = sd_logger_find_highest("S*", 1, FILEIO_ATTRIBUTE_DIRECTORY);
+    }
+    if (last >= 0) {
+        sd_logger_recover_session(last);
+    }
+    sd_logger_session = last + 1;
+    sd_logger_clear_open_files();
+    sd_logger_write_state();
+    if (sd_logger_session >= SD_LOGGER_MAX_SESSIONS) {
+        sd_logger_remove_session(sd_logger_session - SD_LOGGER_MAX_SESSIONS);
+    }
+    
+    sd_logger_session_name(sd_logger_session, name);
+    if (FILEIO_DirectoryMake(name) != FILEIO_RESULT_SUCCESS ||
+            FILEIO_DirectoryChange(name) != FILEIO_RESULT_SUCCESS) {
+        return -1;
+    }
+    sd_logger_session_open = 1;
+    return 0;
 }
 
-static void sd_logger_write_to_file(char *buffer, uint16_t buffer_length) {
-    FILEIO_OBJECT file;
+// Returns the number of sectors needed for a file of full rows
+static uint32_t sd_logger_preallocate_sectors(void) {
+    uint32_t row_size = SD_LOGGER_BINARY ? LOG_ROW_RECORD_SIZE : SD_LOGGER_CSV_ROW_SIZE;
+    uint32_t size = (uint32_t)SD_LOGGER_FILE_SECONDS * sd_logger_rate_hz * row_size;
+    
+    if (size > SD_LOGGER_FILE_MAX_SIZE) {
+        size = SD_LOGGER_FILE_MAX_SIZE;
+    }
+    return size / SD_FILE_SECTOR_SIZE + 1;
+}
+
+// Opens the file for the next trigger window. Its sectors are allocated a few at
+// a time by sd_logger_prepare_process(), so it is ready when a trigger fires.
+static void sd_logger_prepare_trigger_file(void) {
+    char file_name[13];
+    
+    sd_logger_file_name("TRIG", sd_logger_trigger_number, ".CAN", file_name);
+    sd_file_prepare(&sd_logger_capture_file, file_name, SD_LOGGER_TRIGGER_PREALLOCATE);
+}
+
+// Continues with the prepared trigger file when a window opens
+static void sd_logger_open_trigger_file(void) {
+    can_capture_record_t header;
+    char file_name[13];
+    
+    if (sd_file_switch(&sd_logger_capture_file) == 0) {
+        sd_logger_file_name("TRIG", sd_logger_trigger_number, ".CAN", file_name);
+        sd_logger_set_open_file(SD_LOGGER_STATE_CAPTURE, file_name, &sd_logger_capture_file);
+        sd_logger_save_open_files();
+        can_capture_file_header(&header);
+        sd_file_write(&sd_logger_capture_file, &header, sizeof(header));
+        debugprint_string("Trigger, using S");
+        debugprint_uint(sd_logger_session);
+        debugprint_string("\\TRIG");
+        debugprint_uint(sd_logger_trigger_number);
+        debugprint_string("\r\n");
+    }
+}
+
+// Moves the captured frames from the ring buffer to the capture file.
+// In the triggered mode each window goes to a TRIGn.CAN file of its own.
+static void sd_logger_capture_process(void) {
+    can_capture_record_t record;
+    uint8_t window = can_capture_get_window();
+    
+    if (window == CAN_CAPTURE_WINDOW_OPEN && !sd_logger_capture_file.is_open) {
+        sd_logger_open_trigger_file();
+    }
+    while (can_capture_get(&record)) {
+        sd_file_write(&sd_logger_capture_file, &record, sizeof(record));
+    }
+    if (window == CAN_CAPTURE_WINDOW_ENDED) {
+        sd_file_close(&sd_logger_capture_file);
+        sd_logger_trigger_number++;
+        sd_logger_prepare_trigger_file();
+    }
+}
+
+// Opens the next log file and capture file. Their sectors are allocated a few at a time
+// by sd_logger_prepare_process() while the current files are still in use.
+static void sd_logger_prepare_next_files(void) {
+    char file_name[13];
+    
+    sd_logger_file_name("LOG", sd_logger_next_file_number, SD_LOGGER_EXTENSION, file_name);
+    sd_file_prepare(&sd_logger_file, file_name, sd_logger_preallocate_sectors());
+    
+    // Raw frames go to a binary file with the same number
+    if (can_capture_get_mode() == CAN_CAPTURE_ALL) {
+        sd_logger_file_name("LOG", sd_logger_next_file_number, ".CAN", file_name);
+        sd_file_prepare(&sd_logger_capture_file, file_name, SD_LOGGER_CAPTURE_PREALLOCATE);
+    }
+    sd_logger_next_prepared = 1;
+}
+
+// Allocates a batch of sectors of the next files per call, the log file first
+static void sd_logger_prepare_process(void) {
+    if (!sd_logger_next_prepared || sd_file_prepare_step(&sd_logger_file) != 0) {
+        sd_file_prepare_step(&sd_logger_capture_file);
+    }
+}
+
+// Returns 1 when the next files are prepared and switching to them does not wait for
+// their sectors. Trigger files do not follow the log files and are not waited for.
+static uint8_t sd_logger_next_files_ready(void) {
+    return sd_logger_next_prepared && !sd_file_is_preparing(&sd_logger_file) &&
+            (can_capture_get_mode() != CAN_CAPTURE_ALL || !sd_file_is_preparing(&sd_logger_capture_file));
+}
+
+// Closes the current files and continues with the next ones.
+// Whatever is left of their preparation is done here.
+static void sd_logger_switch_files(void) {
+    can_capture_record_t header;
     char file_name[13];
-    static uint8_t write_errors = 0;
-    char temp_string[16] = "";
-    
-    // Write to file
-    strcpy(file_name, "LOG");
-    utl_uint32_to_string(sd_logger_file_number, temp_string, 10);
-    strcat(file_name, temp_string);
-    strcat(file_name, ".CSV");
-    
-    if (FILEIO_Open(&file, file_name, FILEIO_OPEN_WRITE | FILEIO_OPEN_APPEND | FILEIO_OPEN_CREATE) != FILEIO_RESULT_SUCCESS) {
-        write_errors++;
-        IO_LED_R_SetLow();
-        if (write_errors > 16) {
-            asm("reset");
+    
+    if (!sd_logger_next_prepared) {
+        sd_logger_prepare_next_files();
+    }
+    sd_logger_next_prepared = 0;
+    sd_logger_file_number = sd_logger_next_file_number++;
+    sd_file_switch(&sd_logger_file);
+    sd_logger_file_new = 1;
+    sd_logger_row_counter = 0;
+    sd_logger_file_name("LOG", sd_logger_file_number, SD_LOGGER_EXTENSION, file_name);
+    sd_logger_set_open_file(SD_LOGGER_STATE_LOG, file_name, &sd_logger_file);
+    
+    // Frames received so far belong to the old file. Trigger files do not follow the log files.
+    sd_logger_capture_process();
+    if (can_capture_get_mode() == CAN_CAPTURE_ALL && sd_file_switch(&sd_logger_capture_file) == 0) {
+        sd_logger_file_name("LOG", sd_logger_file_number, ".CAN", file_name);
+        sd_logger_set_open_file(SD_LOGGER_STATE_CAPTURE, file_name, &sd_logger_capture_file);
+        can_capture_file_header(&header);
+        sd_file_write(&sd_logger_capture_file, &header, sizeof(header));
+    }
+    sd_logger_save_open_files();
+    
+    debugprint_string("Using logfile S");
+    debugprint_uint(sd_logger_session);
+    debugprint_string("\\LOG");
+    debugprint_uint(sd_logger_file_number);
+    debugprint_string("\r\n");
+}
+
+// Returns 1 when the log file is open, reopens it if opening failed before
+static uint8_t sd_logger_file_ready(void) {
+    char file_name[13];
+    
+    if (!sd_logger_file.is_open) {
+        sd_logger_file_name("LOG", sd_logger_file_number, SD_LOGGER_EXTENSION, file_name);
+        if (sd_file_open(&sd_logger_file, file_name, 0) != 0) {
+            return 0;
         }
-        return;
-    }else {
-        write_errors = 0;
     }
-    FILEIO_Write (buffer, 1, buffer_length, &file);
-    FILEIO_Close (&file);
+    return 1;
+}
+
+static void sd_logger_write_to_file(char *buffer, uint16_t buffer_length) {
+    if (sd_logger_file_ready()) {
+        sd_file_write(&sd_logger_file, buffer, buffer_length);
+    }
 }
 
 int8_t sd_logger_init(void) {
@@ -211,276 +568,265 @@ int8_t sd_logger_init(void) {
     } 
     // Successfully init filesystem
     else {
-        sd_logger_find_free_file_number();
+        // Without a session directory the files go to the current directory after the existing ones
+        if (sd_logger_start_session() != 0) {
+            debugprint_string("Failed to create session directory\r\n");
+            sd_logger_next_file_number = sd_logger_find_highest("LOG*" SD_LOGGER_EXTENSION, 3, FILEIO_ATTRIBUTE_ARCHIVE) + 1;
+            sd_logger_trigger_number = sd_logger_find_highest("TRIG*.CAN", 4, FILEIO_ATTRIBUTE_ARCHIVE) + 1;
+        }
+        can_capture_set_mode(SD_LOGGER_RAW_CAPTURE);
+        if (SD_LOGGER_RAW_CAPTURE == CAN_CAPTURE_TRIGGERED) {
+            sd_logger_prepare_trigger_file();
+        }
+        // Binary logs end each block with a sequence number and CRC, see log_format.h
+        sd_file_set_trailer(&sd_logger_file, SD_LOGGER_BINARY);
+        sd_logger_switch_files();
         timer_sd_logger = softwaretimer_create(SOFTWARETIMER_CONTINUOUS_MODE);
-        sd_logger_file_new = 1;
-        softwaretimer_start(timer_sd_logger, 1000);
-        
-        debugprint_string("Using logfile ");
-        debugprint_uint(sd_logger_file_number);
-        debugprint_string("\r\n");
+        softwaretimer_start(timer_sd_logger, 1000 / sd_logger_rate_hz);
         
         return 0;
     }
 }
 
-void sd_logger_process(void) {
-    //static uint8_t counter;
-    char log_string[512] = "";
-    char temp_string[16] = "";
-    static uint16_t times_written_counter = 0;
+// Returns 1 when a group rate gives a whole number of rows between two samples
+static uint8_t sd_logger_group_rate_fits(uint8_t group_rate_hz, uint8_t rate_hz) {
+    return group_rate_hz == 0 || group_rate_hz >= rate_hz || rate_hz % group_rate_hz == 0;
+}
+
+int8_t sd_logger_set_rate(uint8_t rate_hz) {
+    uint8_t group;
+    
+    if (rate_hz == 0 || rate_hz > SD_LOGGER_MAX_RATE_HZ) {
+        return -1;
+    }
+    for (group = 0; group < LOG_ROW_GROUPS; group++) {
+        if (!sd_logger_group_rate_fits(sd_logger_group_rates_hz[group], rate_hz)) {
+            return -1;
+        }
+    }
+    sd_logger_rate_hz = rate_hz;
+    if (timer_sd_logger != SOFTWARETIMER_NONE) {
+        softwaretimer_start(timer_sd_logger, 1000 / sd_logger_rate_hz);
+    }
+    return 0;
+}
+
+int8_t sd_logger_set_group_rate(uint8_t group, uint8_t rate_hz) {
+    if (group >= LOG_ROW_GROUPS || !sd_logger_group_rate_fits(rate_hz, sd_logger_rate_hz)) {
+        return -1;
+    }
+    sd_logger_group_rates_hz[group] = rate_hz;
+    return 0;
+}
+
+void sd_logger_flush(void) {
+    sd_logger_capture_process();
+    sd_file_flush(&sd_logger_file);
+    sd_file_flush(&sd_logger_capture_file);
+}
+
+void sd_logger_stop(void) {
+    char file_name[13];
+    // Without an open window the trigger file is only prepared
+    uint8_t trigger_prepared = can_capture_get_mode() == CAN_CAPTURE_TRIGGERED && !sd_logger_capture_file.is_open;
+    
+    softwaretimer_stop(timer_sd_logger);
+    sd_logger_capture_process();
+    can_capture_set_mode(CAN_CAPTURE_OFF);
+    sd_file_close(&sd_logger_file);
+    sd_file_close(&sd_logger_capture_file);
+    
+    // Free the clusters of the files prepared for the next rotation
+    if (sd_logger_next_prepared) {
+        sd_logger_file_name("LOG", sd_logger_next_file_number, SD_LOGGER_EXTENSION, file_name);
+        FILEIO_Remove(file_name);
+        sd_logger_file_name("LOG", sd_logger_next_file_number, ".CAN", file_name);
+        FILEIO_Remove(file_name);
+        sd_logger_next_prepared = 0;
+    }
+    if (trigger_prepared) {
+        sd_logger_file_name("TRIG", sd_logger_trigger_number, ".CAN", file_name);
+        FILEIO_Remove(file_name);
+    }
+}
+
+// Writes the column names as csv header
+static void sd_logger_write_csv_header(void) {
     uint8_t i;
     
-    gps_time_t gps_time;
-    gps_coordinates_t gps_coordinates;
-    gps_speed_t gps_speed;
-    mg_battery_t mg_battery;
-    mg_mppt_t mg_mppt;
-    sls_t sls;
-    foil_control_t foil_control;
+    for (i = 0; i < log_row_get_value_columns(); i++) {
+        sd_logger_write_to_file((char *)log_row_get_column(i)->name, strlen(log_row_get_column(i)->name));
+        sd_logger_write_to_file(";", 1);
+    }
+    sd_logger_write_to_file("\r\n", 2);
+}
+
+// Writes the schema block at the start of a binary log file.
+// See log_format.h for the layout.
+static void sd_logger_write_schema(void) {
+    uint8_t header[8];
+    uint8_t column[4];
+    uint16_t record_size = log_row_get_record_size();
+    const log_column_t *description;
+    uint8_t i;
     
-    if (softwaretimer_get_expired(timer_sd_logger) == 1) {
-        // Create new file when written for one hour
-        times_written_counter++;
-        if (times_written_counter == 3601) {
-            sd_logger_find_free_file_number();
-            sd_logger_file_new = 1;
-            
-            debugprint_string("Using logfile ");
-            debugprint_uint(sd_logger_file_number);
-            debugprint_string("\r\n");
-            
-            times_written_counter = 1;
+    memcpy(header, LOG_FORMAT_MAGIC, 4);
+    header[4] = LOG_FORMAT_VERSION;
+    header[5] = SD_LOGGER_DELTA ? LOG_FORMAT_ENCODING_DELTA : LOG_FORMAT_ENCODING_PACKED;
+    header[6] = log_row_get_columns();
+    header[7] = 0;
+    sd_logger_write_to_file((char *)header, 8);
+    header[0] = record_size & 0xFF;
+    header[1] = record_size >> 8;
+    sd_logger_write_to_file((char *)header, 2);
+    
+    for (i = 0; i < log_row_get_columns(); i++) {
+        description = log_row_get_column(i);
+        column[0] = description->type;
+        column[1] = description->scale;
+        column[2] = description->group;
+        column[3] = strlen(description->name);
+        sd_logger_write_to_file((char *)column, 4);
+        sd_logger_write_to_file((char *)description->name, column[3]);
+    }
+}
+
+// Writes a row as semicolon separated values. The cells are formatted straight into
+// the sector buffer, only a cell that may cross the end of the sector goes through a copy.
+static void sd_logger_write_csv_row(const uint32_t *values, uint8_t groups) {
+    char cell[LOG_ROW_CSV_CELL_SIZE];
+    char *cursor;
+    uint16_t space;
+    uint8_t i;
+    
+    if (!sd_logger_file_ready()) {
+        return;
+    }
+    // The stale bitmaps at the end are not written to the csv
+    for (i = 0; i < log_row_get_value_columns(); i++) {
+        cursor = sd_file_cursor(&sd_logger_file, &space);
+        if (space >= LOG_ROW_CSV_CELL_SIZE) {
+            sd_file_commit(&sd_logger_file, log_row_format_cell(cursor, i, values, groups));
+        } else {
+            sd_file_write(&sd_logger_file, cell, log_row_format_cell(cell, i, values, groups));
         }
-        
-        if (sd_logger_file_new == 1) {
-            // Logger
-            strcat(log_string, "Log counter;");
-            sd_logger_write_to_file(log_string, strlen(log_string));
-            strcpy(log_string, "");
-            // GPS
-            strcat(log_string, "Day;Month;Year;Hour;Min;Sec;Latitude deg;Latitude min;Longitude deg;Longitude min;Direction;Speed;");
-            sd_logger_write_to_file(log_string, strlen(log_string));
-            strcpy(log_string, "");
-            // Batt
-            strcat(log_string, "Batt voltage;Batt current; Batt discharge current;Batt charge current;Batt soc;Batt time to go;Batt bms state;");
-            for (i = 0; i < 4; i++) {
-                strcat(log_string, "Batt temp ");
-                utl_uint32_to_string(i, temp_string, 10);
-                strcat(log_string, temp_string);
-                strcat(log_string, ";");
+    }
+    sd_file_write(&sd_logger_file, "\r\n", 2);
+}
+
+// Writes a row as binary record. With delta encoding every SD_LOGGER_KEYFRAME_ROWS
+// rows a full record is written at the start of a sector.
+static void sd_logger_write_record(const uint32_t *values, uint8_t groups) {
+    uint8_t record[LOG_ROW_ENCODED_MAX_SIZE];
+    
+    if (!SD_LOGGER_DELTA) {
+        sd_logger_write_to_file((char *)record, log_row_pack(values, groups, record));
+    } else if ((sd_logger_row_counter - 1) % SD_LOGGER_KEYFRAME_ROWS == 0) {
+        sd_file_pad_sector(&sd_logger_file, LOG_FORMAT_PADDING);
+        log_row_pack(values, groups, sd_logger_previous_record);
+        record[0] = groups | LOG_FORMAT_KEYFRAME;
+        sd_logger_write_to_file((char *)record, 1);
+        sd_logger_write_to_file((char *)&sd_logger_previous_record[1], log_row_get_record_size() - 1);
+    } else {
+        sd_logger_write_to_file((char *)record, log_row_encode(values, groups, sd_logger_previous_record, record));
+    }
+}
+
+// Returns the groups to sample in the next row. The first row of a file has all groups.
+static uint8_t sd_logger_due_groups(void) {
+    uint8_t group, divider;
+    uint8_t groups = LOG_GROUP_BIT(LOG_GROUP_LOGGER);
+    
+    for (group = 0; group < LOG_ROW_GROUPS; group++) {
+        divider = 1;
+        if (sd_logger_group_rates_hz[group] != 0 && sd_logger_group_rates_hz[group] < sd_logger_rate_hz) {
+            divider = sd_logger_rate_hz / sd_logger_group_rates_hz[group];
+        }
+        if (sd_logger_row_counter % divider == 0) {
+            groups |= LOG_GROUP_BIT(group);
+        }
+    }
+    return groups;
+}
+
+// Returns 1 when the current file has been written for SD_LOGGER_FILE_SECONDS or is full.
+// Half a row period of slack keeps a late row from ending up in the old file.
+// With ahead set it returns 1 SD_LOGGER_PREPARE_SECONDS earlier or when the file is 7/8 full.
+static uint8_t sd_logger_file_done(uint8_t ahead) {
+    uint32_t elapsed_ms = softwaretimer_get_ms() - sd_logger_file_start_ms + 500 / sd_logger_rate_hz;
+    uint32_t seconds = SD_LOGGER_FILE_SECONDS;
+    uint32_t size = SD_LOGGER_FILE_MAX_SIZE;
+    
+    if (ahead) {
+        seconds = (seconds > SD_LOGGER_PREPARE_SECONDS) ? seconds - SD_LOGGER_PREPARE_SECONDS : 0;
+        size -= size / 8;
+    }
+    return elapsed_ms >= seconds * 1000UL || sd_file_size(&sd_logger_file) >= size;
+}
+
+void sd_logger_process(void) {
+    static uint32_t values[LOG_ROW_COLUMNS];    // Keeps the values of groups that are not sampled every row
+    uint8_t groups;
+    
+    // Keep the sector write in flight going
+    sd_file_tasks();
+    
+    // Raw frames are written as soon as they arrive
+    sd_logger_capture_process();
+    
+    // Get the next files ready in small steps
+    sd_logger_prepare_process();
+    
+    if (softwaretimer_get_expired(timer_sd_logger) == 1) {
+        // Continue in the next file when written long enough or full
+        if (sd_logger_row_counter != 0) {
+            if (sd_logger_file_done(0)) {
+                sd_logger_switch_files();
+            } else if (!sd_logger_next_prepared && sd_logger_file_done(1)) {
+                sd_logger_prepare_next_files();
             }
-            for (i = 0; i < 12; i++) {
-                strcat(log_string, "Batt cell ");
-                utl_uint32_to_string(i+1, temp_string, 10);
-                strcat(log_string, temp_string);
-                strcat(log_string, " voltage;");
+        }
+        // A new node on the bus adds columns, which takes a new file. Nodes found
+        // shortly after each other, like at power up, come in one file. The next
+        // files are prepared when a node is found and the rows stay in the current
+        // file until they are ready, so the switch does not stall the main loop.
+        // The first row waits for the nodes found at power up.
+        if (sd_logger_node_count != can_bus_get_node_count()) {
+            if (sd_logger_row_counter != 0 && !sd_logger_next_prepared) {
+                sd_logger_prepare_next_files();
             }
-            strcat(log_string, "Power level;");
-            sd_logger_write_to_file(log_string, strlen(log_string));
-            strcpy(log_string, "");
-            // MPPT
-            for (i = 0; i < NODE_ID_MG_MPPT_TOTAL; i++) {
-                strcat(log_string, "MPPT ");
-                utl_uint32_to_string(i + 1, temp_string, 10);
-                strcat(log_string, temp_string);
-                strcat(log_string, " A in;");
-                strcat(log_string, "MPPT ");
-                utl_uint32_to_string(i + 1, temp_string, 10);
-                strcat(log_string, temp_string);
-                strcat(log_string, " V in;");
-                strcat(log_string, "MPPT ");
-                utl_uint32_to_string(i + 1, temp_string, 10);
-                strcat(log_string, temp_string);
-                strcat(log_string, " V out;");
-                strcat(log_string, "MPPT ");
-                utl_uint32_to_string(i + 1, temp_string, 10);
-                strcat(log_string, temp_string);
-                strcat(log_string, " P in;");
+            if (can_bus_get_node_quiet_ms() >= SD_LOGGER_NODE_SETTLE_MS &&
+                    (sd_logger_row_counter == 0 || sd_logger_next_files_ready())) {
+                if (sd_logger_row_counter != 0) {
+                    sd_logger_switch_files();
+                }
+                sd_logger_node_count = can_bus_get_node_count();
+                log_row_update_layout();
+            } else if (sd_logger_node_count == SD_LOGGER_NO_LAYOUT) {
+                return;
             }
-            sd_logger_write_to_file(log_string, strlen(log_string));
-            strcpy(log_string, "");
-            // sls
-            strcat(log_string, "SLS status;SLS limiting;SLS temp power;SLS temp elec;SLS temp motor 1;SLS temp motor 2;SLS UZK;SLS motor current;SLS input current;RPM;");
-            sd_logger_write_to_file(log_string, strlen(log_string));
-            strcpy(log_string, "");
-            
-            // Foil control
-            strcat(log_string, "Foil input 1 pos;Foil output 1 pos;");
-            sd_logger_write_to_file(log_string, strlen(log_string));
-            strcpy(log_string, "");
-            
-            // End of line
-            strcat(log_string, "\r\n");
-            sd_logger_write_to_file(log_string, strlen(log_string));
-            strcpy(log_string, "");
-            
-            sd_logger_file_new = 0;
-        }
-
-        // Create log data
-        // Logger info
-        utl_uint32_to_string(times_written_counter, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        sd_logger_write_to_file(log_string, strlen(log_string));
-        strcpy(log_string, "");
-        
-        // GPS
-        gps_time = get_gps_time();
-        gps_coordinates = get_gps_coordinates();
-        gps_speed = get_gps_speed();
-        // Time and date
-        utl_uint32_to_string(gps_time.day, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_time.month, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_time.year, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_time.hour, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_time.min, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_time.sec, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        // GPS location
-        utl_int32_to_string(gps_coordinates.latitude_degrees, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_coordinates.latitude_minutes, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(gps_coordinates.longitude_degrees, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_coordinates.longitude_minutes, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        // GPS additional data: direction, speed, height, satellites
-        utl_uint32_to_string(gps_speed.direction_degrees, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(gps_speed.speed_kmh, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        sd_logger_write_to_file(log_string, strlen(log_string));
-        strcpy(log_string, "");
-        
-        // MG battery
-        mg_battery = get_can_data_mg_battery();
-        utl_uint32_to_string(mg_battery.voltage_mv, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(mg_battery.current_10ma, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(mg_battery.discharge_current_10ma, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(mg_battery.charge_current_10ma, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(mg_battery.soc, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(mg_battery.time_to_go_min, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(mg_battery.bms_state, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        for (i = 0; i < 4; i++) {
-            utl_uint32_to_string(mg_battery.temp[i], temp_string, 10);
-            strcat(log_string, temp_string);
-            strcat(log_string, ";");
         }
-        for (i = 0; i < 12; i++) {
-            utl_uint32_to_string(mg_battery.cell_voltage_mv[i], temp_string, 10);
-            strcat(log_string, temp_string);
-            strcat(log_string, ";");
+        if (sd_logger_row_counter == 0) {
+            sd_logger_file_start_ms = softwaretimer_get_ms();
         }
-        utl_uint32_to_string(mg_battery.power_level, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        sd_logger_write_to_file(log_string, strlen(log_string));
-        strcpy(log_string, "");
         
-        // MG mppt
-        for (i = 0; i < NODE_ID_MG_MPPT_TOTAL; i++) {
-            mg_mppt = get_can_data_mg_mppt(i);
-            utl_int32_to_string(mg_mppt.current_in_ma, temp_string, 10);
-            strcat(log_string, temp_string);
-            strcat(log_string, ";");
-            utl_uint32_to_string(mg_mppt.voltage_in_mv, temp_string, 10);
-            strcat(log_string, temp_string);
-            strcat(log_string, ";");
-            utl_uint32_to_string(mg_mppt.voltage_out_mv, temp_string, 10);
-            strcat(log_string, temp_string);
-            strcat(log_string, ";");
-            utl_int32_to_string(mg_mppt.power_in_100mw, temp_string, 10);
-            strcat(log_string, temp_string);
-            strcat(log_string, ";");
+        if (sd_logger_file_new == 1) {
+            if (SD_LOGGER_BINARY) {
+                sd_logger_write_schema();
+            } else {
+                sd_logger_write_csv_header();
+            }
+            sd_logger_file_new = 0;
         }
-        sd_logger_write_to_file(log_string, strlen(log_string));
-        strcpy(log_string, "");
-        
-        // SLS
-        sls = get_can_data_sls();
-        utl_uint32_to_string(sls.status, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(sls.limiting, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(sls.temp_power_100mdeg, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(sls.temp_electronics_100mdeg, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(sls.temp_motor_1_100mdeg, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(sls.temp_motor_2_100mdeg, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(sls.uzk_10mv, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(sls.motor_current_100ma, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(sls.input_currect_100ma, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_int32_to_string(sls.rpm, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        sd_logger_write_to_file(log_string, strlen(log_string));
-        strcpy(log_string, "");
-        
-        // Foil control
-        foil_control = get_can_data_foil_control();
-        utl_uint32_to_string(foil_control.primary_input_position, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        utl_uint32_to_string(foil_control.primary_output_position, temp_string, 10);
-        strcat(log_string, temp_string);
-        strcat(log_string, ";");
-        sd_logger_write_to_file(log_string, strlen(log_string));
-        strcpy(log_string, "");
         
-        // New line
-        strcat(log_string, "\r\n");
-        sd_logger_write_to_file(log_string, strlen(log_string));
-        strcpy(log_string, "");
-        
-        debugprint_string("Written to SD card\r\n");
+        // Create log data
+        groups = sd_logger_due_groups();
+        sd_logger_row_counter++;
+        log_row_sample(sd_logger_row_counter, groups, values);
+        if (SD_LOGGER_BINARY) {
+            sd_logger_write_record(values, groups);
+        } else {
+            sd_logger_write_csv_row(values, groups);
+        }
     }
 }
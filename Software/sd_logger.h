@@ -32,10 +32,89 @@
 #define	SD_LOGGER_H
 
 #include <stdint.h>
+#include "can_capture.h"
+
+// Every power up starts a new session directory. Only the last this many sessions
+// are kept, an older session is removed with its files when a new one starts.
+#define SD_LOGGER_MAX_SESSIONS      100
+
+// Set to 1 to write the rows as binary records to LOGn.BIN instead of LOGn.CSV.
+// Tools/log_export converts these files back to csv.
+#define SD_LOGGER_BINARY        0
+
+// Set to 1 to store the binary records as differences to the previous row.
+// A full keyframe row is written every SD_LOGGER_KEYFRAME_ROWS rows, see log_format.h.
+#define SD_LOGGER_DELTA         1
+#define SD_LOGGER_KEYFRAME_ROWS 100
+
+// Raw capture of the received CAN frames, CAN_CAPTURE_* from can_capture.h.
+// CAN_CAPTURE_ALL writes every frame to LOGn.CAN next to the log file.
+// CAN_CAPTURE_TRIGGERED writes the frames around each trigger in the trigger
+// column of can_signals.csv to a TRIGn.CAN file per window. Only CAN_CAPTURE_ALL
+// opens the acceptance filters to every frame. The windows of CAN_CAPTURE_TRIGGERED
+// only hold the frames the filters pass for the decoded values, so the filters keep
+// sparing the CPU. CAN_CAPTURE_ALL shows the whole bus at the cost of receiving every frame.
+#define SD_LOGGER_RAW_CAPTURE   CAN_CAPTURE_TRIGGERED
+
+// Rows per second at startup, can be changed with sd_logger_set_rate()
+#define SD_LOGGER_RATE_HZ       1
+#define SD_LOGGER_MAX_RATE_HZ   50
+
+// Sample rate in Hz of each column group, in the order of LOG_GROUP_* in log_row.h.
+// A group with rate 0 or a rate of at least the row rate is part of every row.
+// Otherwise it is sampled every (row rate / group rate) rows and left empty in between,
+// the rate needs to divide the row rate.
+// The rates can be changed over the debug uart, see main.c.
+#define SD_LOGGER_GROUP_RATES_HZ    {0, 1, 10, 1, 1, 0, 0}
+
+// Columns are only logged for the CANopen nodes found on the bus, see canbus.h.
+// A new node starts a new file with its columns once no other node was found for
+// this long and the sectors of the new file are allocated. Until then the rows go
+// to the current file. Logging starts when no node was found for this long after power up.
+#define SD_LOGGER_NODE_SETTLE_MS    1500
+
+// A new file is started after this time or when the file reaches this size
+#define SD_LOGGER_FILE_SECONDS      3600
+#define SD_LOGGER_FILE_MAX_SIZE     8388608UL   // 8 MB
+
+// The next file is created and allocated in the background this long before
+// it is needed, or when the current file is 7/8 full
+#define SD_LOGGER_PREPARE_SECONDS   120
+
+// Sectors reserved on the card for each new file, see sd_file.h.
+// The log file gets room for SD_LOGGER_FILE_SECONDS of full rows, at most
+// SD_LOGGER_FILE_MAX_SIZE. About 560 bytes per csv row.
+#define SD_LOGGER_CSV_ROW_SIZE              560
+#define SD_LOGGER_CAPTURE_PREALLOCATE       4096    // 2 MB
+#define SD_LOGGER_TRIGGER_PREALLOCATE       64      // 32 KB, about 1600 frames
 
 int8_t sd_logger_init(void);
 
 void sd_logger_process(void);
 
+// Sets the number of rows written per second.
+// Parameters:
+//  rate_hz         1 to SD_LOGGER_MAX_RATE_HZ
+// Returns:
+//  0 on success, -1 if the rate is out of range or a group rate below it
+//  does not divide it.
+int8_t sd_logger_set_rate(uint8_t rate_hz);
+
+// Sets how often a group of columns is sampled.
+// Parameters:
+//  group           LOG_GROUP_* from log_row.h
+//  rate_hz         Samples per second, 0 to sample the group in every row.
+//                  A rate below the row rate needs to divide it.
+// Returns:
+//  0 on success, -1 if the group does not exist or the rate does not divide the row rate.
+int8_t sd_logger_set_group_rate(uint8_t group, uint8_t rate_hz);
+
+// Writes all buffered log data and the file size to the card.
+// Logging continues afterwards.
+void sd_logger_flush(void);
+
+// Stops logging and closes the log file so the card can be removed safely.
+void sd_logger_stop(void);
+
 #endif	/* SD_LOGGER_H */
 
@@ -0,0 +1,301 @@
+/*
+ * File:   sd_stream.c
+ *
+ * Multi block writes in SPI mode. A single block write costs a command, a
+ * response and a busy wait for every 512 bytes. With CMD25 the command is
+ * sent once, the sectors follow each other with a start token and the card
+ * can program them in the background. The blocks are not pre-erased with
+ * ACMD23: an erased block that is not written may read 0xFF, which
+ * sd_file_recover() would take for data.
+ *
+ * The 512 data bytes of a block are moved by two DMA channels: one feeds the
+ * SPI transmit buffer from the sector, the other empties the receive buffer
+ * into a dummy byte. The receive channel interrupts once the last byte is
+ * clocked out. The CRC, the data response and the busy wait are handled by
+ * sd_stream_tasks() from the main loop, so a block in flight never blocks.
+ *
+ * The SPI module is already set up by MCC and shared with the FILEIO driver.
+ * DMA0 and DMA1 are used by the ECAN module.
+ */
+
+#include <xc.h>
+#include <stdint.h>
+#include "sd_stream.h"
+#include "mla_fileio/sd_spi.h"
+#include "softwaretimer.h"
+
+// Commands
+#define SD_STREAM_CMD_WRITE_MULTIPLE_BLOCK      25
+#define SD_STREAM_CMD_READ_OCR                  58
+
+// Tokens
+#define SD_STREAM_TOKEN_START_MULTI     0xFC
+#define SD_STREAM_TOKEN_STOP_TRAN       0xFD
+#define SD_STREAM_DATA_RESPONSE_MASK    0x1F
+#define SD_STREAM_DATA_ACCEPTED         0x05
+
+#define SD_STREAM_OCR_CCS               0x40        // In the first OCR byte: card uses block addressing
+#define SD_STREAM_BUSY_TIMEOUT_MS       500
+#define SD_STREAM_SECTOR_SIZE           512
+
+#define SD_STREAM_DMA_IRQ_SPI1          0x0A        // SPI1 transfer done
+
+// State of the stream
+#define SD_STREAM_CLOSED        0   // No multi block write in progress
+#define SD_STREAM_READY         1   // Card is ready for the next block
+#define SD_STREAM_SENDING       2   // DMA is sending the data
+#define SD_STREAM_PROGRAMMING   3   // Card is busy writing the block
+
+static FILEIO_SD_DRIVE_CONFIG *sd_stream_media = 0;
+static uint8_t sd_stream_block_addressing = 0;
+static uint8_t sd_stream_multi_block = 0;
+static uint8_t sd_stream_state = SD_STREAM_CLOSED;
+static uint32_t sd_stream_sector = 0;           // Sector of the last block
+static const uint8_t *sd_stream_data = 0;       // Data of the last block, to retry it
+static uint8_t sd_stream_lost = 0;              // A block could not be written
+static volatile uint8_t sd_stream_dma_done = 0;
+static uint8_t sd_stream_dma_dummy;
+
+static uint8_t sd_stream_spi_exchange(uint8_t data) {
+    SPI1BUFL = data;
+    while (SPI1STATLbits.SPIRBE);
+    return SPI1BUFL;
+}
+
+// Waits until the card releases the busy signal
+static int8_t sd_stream_wait_ready(void) {
+    uint32_t start = softwaretimer_get_ms();
+    
+    while (sd_stream_spi_exchange(0xFF) != 0xFF) {
+        if (softwaretimer_get_ms() - start > SD_STREAM_BUSY_TIMEOUT_MS) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sends a command with chip select low and returns the R1 response.
+// Chip select stays low.
+static uint8_t sd_stream_command(uint8_t command, uint32_t argument) {
+    uint8_t i, response;
+    
+    sd_stream_media->csFunc(0);
+    if (sd_stream_wait_ready() != 0) {
+        return 0xFF;
+    }
+    sd_stream_spi_exchange(0x40 | command);
+    sd_stream_spi_exchange(argument >> 24);
+    sd_stream_spi_exchange(argument >> 16);
+    sd_stream_spi_exchange(argument >> 8);
+    sd_stream_spi_exchange(argument);
+    sd_stream_spi_exchange(0x01);   // CRC is not checked in SPI mode, only the stop bit
+    
+    // The response comes within 8 bytes
+    for (i = 0; i < 8; i++) {
+        response = sd_stream_spi_exchange(0xFF);
+        if ((response & 0x80) == 0) {
+            break;
+        }
+    }
+    return response;
+}
+
+// Releases the card and gives it the clocks it needs to finish
+static void sd_stream_deselect(void) {
+    sd_stream_media->csFunc(1);
+    sd_stream_spi_exchange(0xFF);
+}
+
+// Sets up DMA2 to feed the SPI transmit buffer and DMA3 to empty the receive buffer.
+// Both are one-shot byte transfers of one sector, started for every block.
+static void sd_stream_dma_init(void) {
+    DMA2CON = 0;
+    DMA2CONbits.SIZE = 1;               // Bytes
+    DMA2CONbits.DIR = 1;                // RAM to peripheral
+    DMA2CONbits.AMODE = 0;              // Post-increment
+    DMA2CONbits.MODE = 1;               // One-shot
+    DMA2REQ = SD_STREAM_DMA_IRQ_SPI1;
+    DMA2PAD = (volatile uint16_t)&SPI1BUFL;
+    DMA2CNT = SD_STREAM_SECTOR_SIZE - 1;
+    
+    DMA3CON = 0;
+    DMA3CONbits.SIZE = 1;               // Bytes
+    DMA3CONbits.DIR = 0;                // Peripheral to RAM
+    DMA3CONbits.AMODE = 1;              // No increment, everything goes to the dummy byte
+    DMA3CONbits.MODE = 1;               // One-shot
+    DMA3REQ = SD_STREAM_DMA_IRQ_SPI1;
+    DMA3PAD = (volatile uint16_t)&SPI1BUFL;
+    DMA3CNT = SD_STREAM_SECTOR_SIZE - 1;
+    DMA3STAL = (uint16_t)&sd_stream_dma_dummy;
+    DMA3STAH = 0;
+    
+    IFS2bits.DMA3IF = 0;
+    IEC2bits.DMA3IE = 1;
+}
+
+// Sends one sector by DMA. The first byte is forced, every received byte requests the next one.
+static void sd_stream_dma_start(const uint8_t *data) {
+    sd_stream_dma_done = 0;
+    DMA2STAL = (uint16_t)data;
+    DMA2STAH = 0;
+    DMA3CONbits.CHEN = 1;
+    DMA2CONbits.CHEN = 1;
+    DMA2REQbits.FORCE = 1;
+}
+
+// The last byte of the sector was received
+void __attribute__((interrupt, no_auto_psv)) _DMA3Interrupt(void) {
+    IFS2bits.DMA3IF = 0;
+    sd_stream_dma_done = 1;
+}
+
+// Ends the multi block write
+static int8_t sd_stream_stop(void) {
+    int8_t res;
+    
+    DMA2CONbits.CHEN = 0;
+    DMA3CONbits.CHEN = 0;
+    sd_stream_state = SD_STREAM_CLOSED;
+    
+    res = sd_stream_wait_ready();
+    sd_stream_spi_exchange(SD_STREAM_TOKEN_STOP_TRAN);
+    sd_stream_spi_exchange(0xFF);
+    if (sd_stream_wait_ready() != 0) {
+        res = -1;
+    }
+    sd_stream_deselect();
+    return res;
+}
+
+// Writes a sector with a single block write
+static void sd_stream_write_single(uint32_t sector, const uint8_t *data) {
+    if (!FILEIO_SD_SectorWrite(sd_stream_media, sector, (uint8_t *)data, false)) {
+        sd_stream_lost = 1;
+    }
+}
+
+// Starts a multi block write
+static int8_t sd_stream_open(uint32_t sector) {
+    if (!sd_stream_block_addressing) {
+        sector *= SD_STREAM_SECTOR_SIZE;
+    }
+    if (sd_stream_command(SD_STREAM_CMD_WRITE_MULTIPLE_BLOCK, sector) != 0x00) {
+        sd_stream_deselect();
+        return -1;
+    }
+    sd_stream_state = SD_STREAM_READY;
+    return 0;
+}
+
+// Waits until the last block is written
+static void sd_stream_wait(void) {
+    uint32_t start = softwaretimer_get_ms();
+    
+    while (sd_stream_state == SD_STREAM_SENDING || sd_stream_state == SD_STREAM_PROGRAMMING) {
+        sd_stream_tasks();
+        if (softwaretimer_get_ms() - start > SD_STREAM_BUSY_TIMEOUT_MS) {
+            sd_stream_stop();
+            sd_stream_lost = 1;
+        }
+    }
+}
+
+// Returns -1 when a block was lost since the last call
+static int8_t sd_stream_result(void) {
+    if (sd_stream_lost) {
+        sd_stream_lost = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int8_t sd_stream_init(FILEIO_SD_DRIVE_CONFIG *media) {
+    uint8_t ocr;
+    
+    sd_stream_media = media;
+    sd_stream_multi_block = 0;
+    sd_stream_state = SD_STREAM_CLOSED;
+    sd_stream_lost = 0;
+    
+    // Standard capacity cards are addressed in bytes, high capacity cards in blocks
+    if (sd_stream_command(SD_STREAM_CMD_READ_OCR, 0) != 0x00) {
+        sd_stream_deselect();
+        return -1;
+    }
+    ocr = sd_stream_spi_exchange(0xFF);
+    sd_stream_spi_exchange(0xFF);
+    sd_stream_spi_exchange(0xFF);
+    sd_stream_spi_exchange(0xFF);
+    sd_stream_deselect();
+    
+    sd_stream_block_addressing = (ocr & SD_STREAM_OCR_CCS) ? 1 : 0;
+    sd_stream_dma_init();
+    sd_stream_multi_block = 1;
+    return 0;
+}
+
+int8_t sd_stream_write(uint32_t sector, const uint8_t *data) {
+    if (sd_stream_media == 0) {
+        return -1;
+    }
+    sd_stream_wait();
+    
+    // Only a sector that follows the last one can continue the stream
+    if (sd_stream_state == SD_STREAM_READY && sector != sd_stream_sector + 1) {
+        if (sd_stream_stop() != 0) {
+            sd_stream_lost = 1;
+        }
+    }
+    if (sd_stream_state == SD_STREAM_CLOSED) {
+        if (!sd_stream_multi_block || sd_stream_open(sector) != 0) {
+            sd_stream_write_single(sector, data);
+            return sd_stream_result();
+        }
+    }
+    
+    sd_stream_sector = sector;
+    sd_stream_data = data;
+    sd_stream_spi_exchange(SD_STREAM_TOKEN_START_MULTI);
+    sd_stream_state = SD_STREAM_SENDING;
+    sd_stream_dma_start(data);
+    return sd_stream_result();
+}
+
+void sd_stream_tasks(void) {
+    uint8_t response;
+    
+    if (sd_stream_state == SD_STREAM_SENDING) {
+        if (!sd_stream_dma_done) {
+            return;
+        }
+        // Dummy CRC
+        sd_stream_spi_exchange(0xFF);
+        sd_stream_spi_exchange(0xFF);
+        
+        response = sd_stream_spi_exchange(0xFF);
+        if ((response & SD_STREAM_DATA_RESPONSE_MASK) != SD_STREAM_DATA_ACCEPTED) {
+            // The data is still there, write it on its own
+            sd_stream_stop();
+            sd_stream_write_single(sd_stream_sector, sd_stream_data);
+            return;
+        }
+        sd_stream_state = SD_STREAM_PROGRAMMING;
+    }
+    
+    // Poll the busy signal once, the card keeps programming in the background
+    if (sd_stream_state == SD_STREAM_PROGRAMMING && sd_stream_spi_exchange(0xFF) == 0xFF) {
+        sd_stream_state = SD_STREAM_READY;
+    }
+}
+
+uint8_t sd_stream_is_busy(void) {
+    return sd_stream_state == SD_STREAM_SENDING || sd_stream_state == SD_STREAM_PROGRAMMING;
+}
+
+int8_t sd_stream_close(void) {
+    sd_stream_wait();
+    if (sd_stream_state == SD_STREAM_READY && sd_stream_stop() != 0) {
+        sd_stream_lost = 1;
+    }
+    return sd_stream_result();
+}
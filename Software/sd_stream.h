@@ -0,0 +1,51 @@
+/* 
+ * File:                sd_stream.h
+ * Comments:            Multi block (CMD25) sector writes to the sd card over SPI.
+ *                      A stream writes consecutive sectors with one command
+ *                      instead of a full command/response/busy cycle per sector.
+ *                      The sector data is sent by DMA, so the caller can fill
+ *                      the next sector while the previous one goes out.
+ *                      The card may not be used through FILEIO while a stream is open.
+ */
+
+// This is a guard condition so that contents of this file are not included
+// more than once.  
+#ifndef SD_STREAM_H
+#define	SD_STREAM_H
+
+#include <stdint.h>
+#include "mla_fileio/sd_spi.h"
+
+// Reads the card type to know how sectors are addressed and sets up the DMA channels.
+// Needs to be called after FILEIO mounted the card.
+// Parameters:
+//  *media          The media parameters also given to FILEIO
+// Returns:
+//  0 on success, -1 if the card did not respond. Sectors are then written one at a time.
+int8_t sd_stream_init(FILEIO_SD_DRIVE_CONFIG *media);
+
+// Starts writing a sector and returns while it is sent by DMA.
+// The open stream is continued when the sector follows the previous one,
+// otherwise it is closed and a new one is started. Waits first until the
+// previous sector is written.
+// Parameters:
+//  sector          The sector to write
+//  *data           512 bytes of data. Must not be changed until the next
+//                  sd_stream_write() or sd_stream_close() returned.
+// Returns:
+//  0 on success, -1 if this or the previous sector could not be written.
+int8_t sd_stream_write(uint32_t sector, const uint8_t *data);
+
+// Continues a write in progress without waiting. Call from the main loop.
+void sd_stream_tasks(void);
+
+// Returns 1 while a sector is sent or programmed, so sd_stream_close() would wait for it.
+uint8_t sd_stream_is_busy(void);
+
+// Waits until the last sector is written and ends the multi block write.
+// Needs to be called before the card is used through FILEIO.
+// Returns:
+//  0 on success or when no stream was open, -1 if the last sector could not be written.
+int8_t sd_stream_close(void);
+
+#endif	/* SD_STREAM_H */
@@ -21,11 +21,16 @@ static volatile struct{
     uint8_t expired : 1;
 } softwaretimers[SOFTWARETIMER_MAX_TIMERS] = {};
 
+// Time since init
+static volatile uint32_t softwaretimer_ms = 0;
+
 
 // Timer 1 interrupt. Triggers every 1 ms
 void softwaretimer_interrupt_callback(void) {
     uint8_t timer_number;
     
+    softwaretimer_ms++;
+    
     // Check all timers
     for (timer_number = 0; timer_number < SOFTWARETIMER_MAX_TIMERS; timer_number++) {
         // Skip non used and non running timers
@@ -164,3 +169,17 @@ int8_t softwaretimer_get_expired(uint8_t timer_number) {
         return 0;
     }
 }
+
+// Returns the time since the timers were initialized.
+// Returns:
+//  Time in ms. Wraps after about 49 days.
+uint32_t softwaretimer_get_ms(void) {
+    uint32_t ms;
+    
+    // The counter is updated in the interrupt and cannot be read in one instruction.
+    // Read again until the value did not change in between.
+    do {
+        ms = softwaretimer_ms;
+    } while (ms != softwaretimer_ms);
+    return ms;
+}
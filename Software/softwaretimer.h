@@ -59,6 +59,11 @@ int8_t softwaretimer_stop(uint8_t timer_number);
 //  -1 if the timer number was not a running timer or out of range.
 int8_t softwaretimer_get_expired(uint8_t timer_number);
 
+// Returns the time since the timers were initialized.
+// Returns:
+//  Time in ms. Wraps after about 49 days.
+uint32_t softwaretimer_get_ms(void);
+
 
 #endif	/* SOFTWARETIMER_H */
 
@@ -3,6 +3,9 @@
 
 static const char hex_chars[] = "0123456789ABCDEF";
 
+// 10^scale is 5^scale * 2^scale, the powers of 2 go in the exponent
+static const uint8_t utl_powers_of_5[UTL_FLOAT_MAX_SCALE + 1] = {1, 5, 25, 125};
+
 /**
  * Function prototype:  char *utl_uint32_to_string(UINT32 value, char *str, UINT8 radix)
  * Description:         Converts an unsigned integer to a null terminated string
@@ -99,6 +102,39 @@ char *utl_uint32_to_string_len(uint32_t value, char *str, uint8_t radix, uint8_t
     return ptr;
 }
 
+/**
+ * Function prototype:  UINT8 utl_uint32_format(UINT32 value, char *str)
+ * Description:         Writes an unsigned integer in decimal at str, without null termination
+ */
+uint8_t utl_uint32_format(uint32_t value, char *str) {
+    char temp[10];
+    uint8_t index, length;
+
+    index = 0;                              // Do conversion
+    do {
+        temp[index++] = '0' + value % 10;   // Rest is char LSB first
+        value = value / 10;
+    } while (value != 0);
+
+    length = index;
+    while (index != 0) {                    // Swap LSB MSB
+        *str++ = temp[--index];
+    }
+    return length;
+}
+
+/**
+ * Function prototype:  UINT8 utl_int32_format(INT32 value, char *str)
+ * Description:         Writes an integer in decimal at str, without null termination
+ */
+uint8_t utl_int32_format(int32_t value, char *str) {
+    if (value < 0) {                        // Negative number
+        *str = '-';
+        return utl_uint32_format(-(uint32_t)value, str + 1) + 1;
+    }
+    return utl_uint32_format(value, str);
+}
+
 /**
  * Function prototype:  char *utl_float_to_string(float value, char *str, UINT8 radix, UINT8 precision)
  * Description:         Converts an float to a null terminated string
@@ -143,6 +179,69 @@ char *utl_float_to_string(float value, char *str) {
     return ptr;
 }
 
+/**
+ * Function prototype:  INT32 utl_float_to_fixed(UINT32 bits, INT8 scale, UINT8 is_signed)
+ * Description:         Converts the bits of a float to the 16 bit integer of the value times 10^scale,
+ *                      with integer math only. The float library takes hundreds of cycles per
+ *                      operation on the dsPIC.
+ */
+int32_t utl_float_to_fixed(uint32_t bits, int8_t scale, uint8_t is_signed) {
+    uint16_t exponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFFUL;
+    uint8_t negative = (bits & 0x80000000UL) != 0;
+    uint32_t number = mantissa | 0x800000UL;
+    uint32_t divisor = 1;
+    uint32_t result, remainder, limit;
+    int16_t shift;
+    
+    // 0, subnormals that round to 0 at any scale, and NaN
+    if (exponent == 0 || (exponent == 0xFF && mantissa != 0)) {
+        return 0;
+    }
+    if (is_signed) {
+        limit = negative ? 32768 : 32767;
+    } else {
+        limit = negative ? 0 : 65535;
+    }
+    
+    // The value is number * 2^(exponent - 150) and the result number / divisor * 2^shift
+    if (scale >= 0) {
+        number *= utl_powers_of_5[scale];
+    } else {
+        divisor = utl_powers_of_5[-scale];
+    }
+    shift = (int16_t)exponent - 150 + scale;
+    
+    if (shift > 0) {
+        // At least 2^23 / 125 * 2^1 > 65535, infinity ends up here as well
+        result = limit;
+    } else if (divisor == 1) {
+        // The last bit shifted out is the half
+        if (shift == 0) {
+            result = number;
+        } else if (shift > -32) {
+            result = (number >> -shift) + ((number >> (-shift - 1)) & 1);
+        } else {
+            result = 0;
+        }
+    } else if (shift > -25) {
+        // The number is below 2^24 so the divisor fits in 32 bits
+        divisor <<= -shift;
+        result = number / divisor;
+        remainder = number - result * divisor;
+        if (remainder >= divisor - remainder) {
+            result++;
+        }
+    } else {
+        result = 0;
+    }
+    
+    if (result > limit) {
+        result = limit;
+    }
+    return negative ? -(int32_t)result : (int32_t)result;
+}
+
 /**
  * Function prototype:  UINT32 utl_string_to_uint32(char *str, UINT8 radix)
  * Description:         Converts a null terminated string to an unsigned integer
@@ -203,46 +302,52 @@ int32_t utl_string_to_int32(char *str, uint8_t radix) {
     return value;
 }
 
-#define CRC_POLY_CRC16_CCITT 0x1021 // X^16 + X^12 + X^5 + 1
-
-/**
- *     <b>Function prototype:</b><br>   static void hash_crc_16ccitt(WORD *crc,BYTE data)
- * <br>
- * <br><b>Description:</b><br>          Calculate CRC 16 CCITT
- * <br>
- * <br><b>Precondition:</b><br>         None
- * <br>
- * <br><b>Inputs:</b><br>               WORD *crc:  The crc to add this byte to
- * <br>                                 BYTE data:  byte to add on CRC
- * <br>
- * <br><b>Outputs:</b><br>              None
- * <br>
- * <br><b>Example:</b><br>              hash_crc_16ccitt(&wCrc,*pdata);
- */
-static void hash_crc_16ccitt(uint16_t *crc,uint8_t data) {
-    uint8_t cnt;
-
-    *crc = ((uint16_t)data << 8) ^ *crc;
-    for (cnt = 0; cnt < 8; cnt++) {
-        if (*crc & 0x8000) {
-            *crc = (*crc << 1) ^ CRC_POLY_CRC16_CCITT;
-        } else {
-            *crc <<= 1;
-        }
-    }
-}
+// CRC 16 CCITT (X^16 + X^12 + X^5 + 1) of each byte value, so a byte takes one
+// table lookup instead of 8 shift and xor steps
+static const uint16_t crc16_ccitt_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
 
 /**
  * Function prototype:  UINT16 utl_calc_crc(UINT8 *pdata, UINT32 ui_size)
  * Description:         Calculates the CRC 16 CCITT of a byte array buffer.
  */
 uint16_t utl_calc_crc(uint8_t *pdata, uint32_t ui_size) {
-   int n=0;
-   uint16_t wCrc = 0x1D0F;
-
-   for (n=0; n<ui_size ; n++) {
-      hash_crc_16ccitt(&wCrc,*pdata);
-      pdata++;
-   }
-   return wCrc;
+    uint16_t wCrc = 0x1D0F;
+
+    while (ui_size-- != 0) {
+        wCrc = (wCrc << 8) ^ crc16_ccitt_table[(uint8_t)(wCrc >> 8) ^ *pdata++];
+    }
+    return wCrc;
 }
@@ -56,6 +56,40 @@ char *utl_int32_to_string(int32_t value, char *str, uint8_t radix);
  */
 char *utl_uint32_to_string_len(uint32_t value, char *str, uint8_t radix, uint8_t len);
 
+/**
+ *     <b>Function prototype:</b><br>   UINT8 utl_uint32_format(UINT32 value, char *str)
+ * <br>
+ * <br><b>Description:</b><br>          Writes an unsigned integer in decimal at str, without null termination.
+ * <br>                                 At most 10 characters are written.
+ * <br>
+ * <br><b>Precondition:</b><br>         None
+ * <br>
+ * <br><b>Inputs:</b><br>               UINT32 value:   The value to convert
+ * <br>                                 char *str:      Pointer to the write position in a buffer
+ * <br>
+ * <br><b>Outputs:</b><br>              Number of characters written
+ * <br>
+ * <br><b>Example:</b><br>              cursor += utl_uint32_format(456, cursor);   //Append to buffer
+ */
+uint8_t utl_uint32_format(uint32_t value, char *str);
+
+/**
+ *     <b>Function prototype:</b><br>   UINT8 utl_int32_format(INT32 value, char *str)
+ * <br>
+ * <br><b>Description:</b><br>          Writes an integer in decimal at str, without null termination.
+ * <br>                                 At most 11 characters are written.
+ * <br>
+ * <br><b>Precondition:</b><br>         None
+ * <br>
+ * <br><b>Inputs:</b><br>               INT32 value:    The value to convert
+ * <br>                                 char *str:      Pointer to the write position in a buffer
+ * <br>
+ * <br><b>Outputs:</b><br>              Number of characters written
+ * <br>
+ * <br><b>Example:</b><br>              cursor += utl_int32_format(-456, cursor);   //Append to buffer
+ */
+uint8_t utl_int32_format(int32_t value, char *str);
+
 /**
  * Function prototype:  
  * Description:         
@@ -77,6 +111,29 @@ char *utl_uint32_to_string_len(uint32_t value, char *str, uint8_t radix, uint8_t
  */
 char *utl_float_to_string(float value, char *str);
 
+// Scales accepted by utl_float_to_fixed(), floats are scaled by 10^-3 to 10^3
+#define UTL_FLOAT_MAX_SCALE     3
+
+/**
+ *     <b>Function prototype:</b><br>   INT32 utl_float_to_fixed(UINT32 bits, INT8 scale, UINT8 is_signed)
+ * <br>
+ * <br><b>Description:</b><br>          Converts an IEEE-754 single precision float to the 16 bit integer of
+ * <br>                                 the value times 10^scale, with integer math only. Rounds to the
+ * <br>                                 nearest with halves away from 0 and saturates to the range of the
+ * <br>                                 type. NaN gives 0.
+ * <br>
+ * <br><b>Precondition:</b><br>         None
+ * <br>
+ * <br><b>Inputs:</b><br>               UINT32 bits:    The bits of the float
+ * <br>                                 INT8 scale:     Power of 10, -UTL_FLOAT_MAX_SCALE to UTL_FLOAT_MAX_SCALE
+ * <br>                                 UINT8 is_signed: 1 for the range of int16_t, 0 for uint16_t
+ * <br>
+ * <br><b>Outputs:</b><br>              The scaled value
+ * <br>
+ * <br><b>Example:</b><br>              value = utl_float_to_fixed(0x3FC00000, 1, 1);    //1.5 gives 15
+ */
+int32_t utl_float_to_fixed(uint32_t bits, int8_t scale, uint8_t is_signed);
+
 /**
  *     <b>Function prototype:</b><br>   UINT32 utl_string_to_uint32(char *str, UINT8 radix)
  * <br>
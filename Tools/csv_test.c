@@ -0,0 +1,146 @@
+/*
+ * File:   csv_test.c
+ *
+ * Golden test of the csv rows of the logger. Fixed rows go through
+ * log_row_format_cell() of Software/log_row.c, the same code the logger
+ * formats its csv cells with, and the bytes are compared with the expected
+ * rows below. The data sources of log_row.c are stubbed: no CAN node is found,
+ * so the layout is the fixed columns of log_row.h with their stale bitmaps and
+ * does not change with can_signals.csv.
+ *
+ * Build:  gcc -O2 -Wall -Ihost -o csv_test csv_test.c ../Software/log_row.c ../Software/utl.c
+ * Usage:  csv_test        returns 0 when all rows match
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../Software/log_row.h"
+#include "../Software/canbus.h"
+#include "../Software/can_stats.h"
+#include "../Software/gps.h"
+#include "../Software/softwaretimer.h"
+
+#define ALL             LOG_GROUP_ALL
+#define LOGGER          LOG_GROUP_BIT(LOG_GROUP_LOGGER)
+#define STALE           26          // First stale bitmap, after the fixed columns
+
+typedef struct {
+    uint8_t groups;
+    uint32_t values[STALE + 4];
+    const char *csv;
+} test_row_t;
+
+static const test_row_t test_rows[] = {
+    // All groups sampled
+    {ALL, {1, 1000, 17, 10, 26, 12, 34, 56, 52, 2212345, 4, 5467890, 1795, 1234,
+            812, 425, 23, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+            "1;1000;17;10;26;12;34;56;52;2212345;4;5467890;1795;1234;812;425;23;0;0;0;0;0;0;0;0;0;\r\n"},
+    // Only the logger group, the gps cells stay empty
+    {LOGGER, {2, 1100, 17, 10, 26, 12, 34, 56, 52, 2212345, 4, 5467890, 1795, 1234,
+            790, 401, 22, 1, 96, 3, 7, 2, 1, 0, 12, 3},
+            "2;1100;;;;;;;;;;;;;790;401;22;1;96;3;7;2;1;0;12;3;\r\n"},
+    // Negative coordinates are sign extended int32_t
+    {ALL, {3, 1200, 1, 1, 0, 0, 0, 0, (uint32_t)-33, 0, (uint32_t)-151, 99999, 0, 0,
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+            "3;1200;1;1;0;0;0;0;-33;0;-151;99999;0;0;0;0;0;0;0;0;0;0;0;0;0;0;\r\n"},
+    // Longest cells
+    {ALL, {4294967295UL, 4294967295UL, 255, 255, 255, 255, 255, 255, (uint32_t)INT32_MIN,
+            4294967295UL, (uint32_t)INT32_MAX, 1000000000, 65535, 65535, 65535, 65535,
+            255, 255, 255, 255, 65535, 65535, 65535, 65535, 65535, 65535},
+            "4294967295;4294967295;255;255;255;255;255;255;-2147483648;4294967295;2147483647;"
+            "1000000000;65535;65535;65535;65535;255;255;255;255;65535;65535;65535;65535;65535;65535;\r\n"},
+    // Stale columns are empty, bits in every bitmap
+    {ALL, {5, 1400, 17, 10, 26, 12, 34, 57, 52, 2212345, 4, 5467890, 1795, 1234,
+            812, 425, 23, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x80, 0x03, 0x80, 0x02},
+            "5;1400;17;10;26;12;34;;;;4;5467890;1795;1234;812;425;23;0;0;0;0;0;0;;0;;\r\n"},
+};
+
+// No node is found, so no CAN column is in the layout and these are not called
+// for values
+uint8_t can_bus_is_signal_found(uint8_t signal) {
+    return 0;
+}
+
+uint8_t can_bus_is_aggregate_found(uint8_t aggregate) {
+    return 0;
+}
+
+uint32_t can_bus_get_signal_age(uint8_t signal) {
+    return 0;
+}
+
+int8_t can_bus_take_aggregate(uint8_t aggregate, can_bus_aggregate_t *result) {
+    memset(result, 0, sizeof(*result));
+    return 0;
+}
+
+const can_data_t *can_bus_acquire_data(void) {
+    static can_data_t data;
+    
+    return &data;
+}
+
+void can_bus_release_data(void) {
+}
+
+void can_stats_get(can_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+gps_time_t get_gps_time(void) {
+    gps_time_t time = {0};
+    
+    return time;
+}
+
+gps_coordinates_t get_gps_coordinates(void) {
+    gps_coordinates_t coordinates = {0};
+    
+    return coordinates;
+}
+
+gps_speed_t get_gps_speed(void) {
+    gps_speed_t speed = {0};
+    
+    return speed;
+}
+
+uint32_t softwaretimer_get_ms(void) {
+    return 0;
+}
+
+// Formats a row the way sd_logger_write_csv_row() does, returns the length
+static int format_row(const test_row_t *row, char *csv) {
+    int length = 0;
+    uint8_t i;
+    
+    for (i = 0; i < log_row_get_value_columns(); i++) {
+        length += log_row_format_cell(&csv[length], i, row->values, row->groups);
+    }
+    csv[length++] = '\r';
+    csv[length++] = '\n';
+    return length;
+}
+
+int main(void) {
+    char csv[LOG_ROW_VALUE_COLUMNS * LOG_ROW_CSV_CELL_SIZE + 2];
+    int i, length, failed = 0;
+    
+    log_row_update_layout();
+    if (log_row_get_value_columns() != STALE || log_row_get_columns() != STALE + 4) {
+        printf("Layout has %u value columns and %u columns, expected %u and %u\n",
+                log_row_get_value_columns(), log_row_get_columns(), STALE, STALE + 4);
+        return 1;
+    }
+    
+    for (i = 0; i < (int)(sizeof(test_rows) / sizeof(test_rows[0])); i++) {
+        length = format_row(&test_rows[i], csv);
+        if (length != (int)strlen(test_rows[i].csv) || memcmp(csv, test_rows[i].csv, length) != 0) {
+            printf("Row %d differs\n  got:      %.*s  expected: %s", i + 1, length, csv, test_rows[i].csv);
+            failed++;
+        }
+    }
+    printf("%d of %d rows match\n", i - failed, i);
+    return failed != 0;
+}
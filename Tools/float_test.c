@@ -0,0 +1,83 @@
+/*
+ * File:   float_test.c
+ *
+ * Exhaustive test of utl_float_to_fixed() in Software/utl.c, which converts
+ * the float values received on the CAN bus with integer math. Every one of
+ * the 2^32 float bit patterns is converted at every scale, signed and
+ * unsigned, and compared with the value computed with double math: rounded to
+ * the nearest with halves away from 0, saturated to the range of the type and
+ * 0 for NaN. Takes about 10 minutes.
+ *
+ * Build:  gcc -O2 -Wall -o float_test float_test.c ../Software/utl.c -lm
+ * Usage:  float_test              all scales
+ *         float_test -1 2         only the scales -1 to 2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "../Software/utl.h"
+
+#define REPORT_MISMATCHES   5       // Mismatches printed per scale and type
+
+static const double powers_of_10[UTL_FLOAT_MAX_SCALE + 1] = {1, 10, 100, 1000};
+
+// Converts with double math. A float times 10^scale is exact in a double and
+// the quotient of a division is rounded correctly, so halves are found.
+static int32_t reference(uint32_t bits, int scale, int is_signed) {
+    float f;
+    double value, low, high;
+    
+    memcpy(&f, &bits, sizeof(f));
+    if (isnan(f)) {
+        return 0;
+    }
+    value = scale >= 0 ? (double)f * powers_of_10[scale] : (double)f / powers_of_10[-scale];
+    low = is_signed ? -32768 : 0;
+    high = is_signed ? 32767 : 65535;
+    if (value <= low) {
+        return low;
+    }
+    if (value >= high) {
+        return high;
+    }
+    return (int32_t)round(value);
+}
+
+int main(int argc, char **argv) {
+    int from = argc > 1 ? atoi(argv[1]) : -UTL_FLOAT_MAX_SCALE;
+    int to = argc > 2 ? atoi(argv[2]) : UTL_FLOAT_MAX_SCALE;
+    int scale, is_signed;
+    long mismatches, total = 0;
+    uint32_t bits;
+    int32_t result, expected;
+    float f;
+    
+    if (from < -UTL_FLOAT_MAX_SCALE || to > UTL_FLOAT_MAX_SCALE || from > to) {
+        printf("The scales need to be between %d and %d\n", -UTL_FLOAT_MAX_SCALE, UTL_FLOAT_MAX_SCALE);
+        return 2;
+    }
+    for (scale = from; scale <= to; scale++) {
+        for (is_signed = 0; is_signed < 2; is_signed++) {
+            mismatches = 0;
+            bits = 0;
+            do {
+                result = utl_float_to_fixed(bits, scale, is_signed);
+                expected = reference(bits, scale, is_signed);
+                if (result != expected) {
+                    if (mismatches < REPORT_MISMATCHES) {
+                        memcpy(&f, &bits, sizeof(f));
+                        printf("%08X %.9g: got %d, expected %d\n", bits, f, result, expected);
+                    }
+                    mismatches++;
+                }
+            } while (++bits != 0);
+            printf("Scale %d %s: %ld mismatches\n", scale, is_signed ? "signed" : "unsigned", mismatches);
+            fflush(stdout);
+            total += mismatches;
+        }
+    }
+    return total != 0;
+}
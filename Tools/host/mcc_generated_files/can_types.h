@@ -0,0 +1,13 @@
+/*
+ * File:   can_types.h
+ *
+ * Stand-in for the MCC generated header on host builds of the Tools. Only
+ * declares the frame type named in the firmware headers.
+ */
+
+#ifndef CAN_TYPES_H
+#define CAN_TYPES_H
+
+typedef union uCAN_MSG uCAN_MSG;
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * File:   log_export.c
+ *
+ * Converts a binary log file (LOGn.BIN) written by the logger back to the
+ * semicolon separated csv layout of LOGn.CSV. Both packed and delta encoded
+ * records are supported. Block trailers are skipped, Tools/log_verify checks them.
+ *
+ * Build:  gcc -O2 -Wall -o log_export log_export.c
+ * Usage:  log_export LOG3.BIN > LOG3.CSV
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../Software/log_format.h"
+
+#define MAX_COLUMNS     1024
+
+typedef struct {
+    uint8_t type;
+    int8_t scale;
+    uint8_t group;
+    char name[256];
+} column_t;
+
+static column_t columns[MAX_COLUMNS];
+static uint16_t column_count;
+static uint16_t record_size;
+static uint8_t version;
+static uint8_t encoding;
+static uint32_t values[MAX_COLUMNS];        // Raw column values in the width of their type
+static uint16_t block_data_size = LOG_FORMAT_BLOCK_SIZE;    // Bytes of a block before the trailer
+
+static int read_bytes(FILE *f, void *buffer, size_t length) {
+    return fread(buffer, 1, length, f) == length ? 0 : -1;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)p[0] | (uint16_t)p[1] << 8;
+}
+
+// Reads the schema block at the start of the file
+static int read_schema(FILE *f) {
+    uint8_t header[10];
+    uint8_t entry[4];
+    uint8_t entry_size;
+    uint16_t i, size = 0;
+    
+    if (read_bytes(f, header, sizeof(header)) != 0 || memcmp(header, LOG_FORMAT_MAGIC, 4) != 0) {
+        fprintf(stderr, "Not a binary log file\n");
+        return -1;
+    }
+    version = header[4];
+    if (version == 0 || version > LOG_FORMAT_VERSION) {
+        fprintf(stderr, "Unsupported version %u\n", version);
+        return -1;
+    }
+    encoding = header[5];
+    if (encoding != LOG_FORMAT_ENCODING_PACKED &&
+            !(encoding == LOG_FORMAT_ENCODING_DELTA && version >= 2)) {
+        fprintf(stderr, "Unsupported encoding %u\n", encoding);
+        return -1;
+    }
+    column_count = get_u16(&header[6]);
+    record_size = get_u16(&header[8]);
+    if (column_count > MAX_COLUMNS) {
+        fprintf(stderr, "Too many columns\n");
+        return -1;
+    }
+    
+    // Version 1 has no groups, all columns are in every record
+    entry_size = version >= 2 ? 4 : 3;
+    if (version >= 2) {
+        size = 1;
+    }
+    for (i = 0; i < column_count; i++) {
+        if (read_bytes(f, entry, entry_size) != 0 ||
+                read_bytes(f, columns[i].name, entry[entry_size - 1]) != 0) {
+            fprintf(stderr, "Truncated schema\n");
+            return -1;
+        }
+        columns[i].type = entry[0];
+        columns[i].scale = (int8_t)entry[1];
+        columns[i].group = version >= 2 ? entry[2] : 0;
+        columns[i].name[entry[entry_size - 1]] = '\0';
+        size += LOG_TYPE_SIZE(columns[i].type);
+    }
+    if (size != record_size) {
+        fprintf(stderr, "Record size %u does not match the columns (%u)\n", record_size, size);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_header(FILE *out) {
+    uint16_t i;
+    
+    for (i = 0; i < column_count; i++) {
+        if (columns[i].type != LOG_TYPE_STALE) {
+            fprintf(out, "%s;", columns[i].name);
+        }
+    }
+    fprintf(out, "\r\n");
+}
+
+// Unpacks a packed record into the column values
+static uint8_t unpack_record(const uint8_t *record) {
+    uint16_t i;
+    uint8_t size, b;
+    uint8_t groups = 0xFF;
+    
+    if (version >= 2) {
+        groups = *record++ & ~LOG_FORMAT_KEYFRAME;
+    }
+    for (i = 0; i < column_count; i++) {
+        size = LOG_TYPE_SIZE(columns[i].type);
+        values[i] = 0;
+        for (b = 0; b < size; b++) {
+            values[i] |= (uint32_t)record[b] << (8 * b);
+        }
+        record += size;
+    }
+    return groups;
+}
+
+static int read_varint(FILE *f, uint32_t *value) {
+    uint8_t shift;
+    int c;
+    
+    *value = 0;
+    for (shift = 0; shift < 35; shift += 7) {
+        c = fgetc(f);
+        if (c == EOF) {
+            return -1;
+        }
+        *value |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Applies a delta record to the column values. The group byte is already read.
+static int decode_delta(FILE *f, uint8_t groups) {
+    uint8_t bitmap[MAX_COLUMNS / 8];
+    uint16_t i, bit = 0;
+    uint8_t size;
+    uint32_t delta;
+    
+    for (i = 0; i < column_count; i++) {
+        if (groups & (1 << columns[i].group)) {
+            bit++;
+        }
+    }
+    if (read_bytes(f, bitmap, (bit + 7) / 8) != 0) {
+        return -1;
+    }
+    
+    bit = 0;
+    for (i = 0; i < column_count; i++) {
+        if (!(groups & (1 << columns[i].group))) {
+            continue;
+        }
+        if (bitmap[bit / 8] & (1 << (bit % 8))) {
+            if (read_varint(f, &delta) != 0) {
+                return -1;
+            }
+            // Undo the zig-zag encoding and add in the width of the column
+            delta = (delta >> 1) ^ (0 - (delta & 1));
+            size = LOG_TYPE_SIZE(columns[i].type);
+            values[i] += delta;
+            if (size < 4) {
+                values[i] &= (1UL << (8 * size)) - 1;
+            }
+        }
+        bit++;
+    }
+    return 0;
+}
+
+static void print_record(FILE *out, uint8_t groups) {
+    uint8_t stale[MAX_COLUMNS / 8] = {0};
+    uint16_t i, n = 0;
+    uint8_t size;
+    uint32_t value;
+    
+    // Collect the stale bitmaps (version 4 and up)
+    for (i = 0; i < column_count && n < sizeof(stale); i++) {
+        if (columns[i].type == LOG_TYPE_STALE) {
+            stale[n++] = values[i];
+        }
+    }
+    
+    for (i = 0; i < column_count; i++) {
+        size = LOG_TYPE_SIZE(columns[i].type);
+        value = values[i];
+        
+        if (columns[i].type == LOG_TYPE_STALE) {
+            continue;
+        }
+        // Not sampled in this record or stale
+        if (!(groups & (1 << columns[i].group)) || (stale[i / 8] & (1 << (i % 8)))) {
+            fprintf(out, ";");
+        } else if (LOG_TYPE_IS_SIGNED(columns[i].type)) {
+            // Sign extend to 32 bit
+            if (size < 4 && (value & (1UL << (8 * size - 1)))) {
+                value |= ~0UL << (8 * size);
+            }
+            fprintf(out, "%ld;", (long)(int32_t)value);
+        } else {
+            fprintf(out, "%lu;", (unsigned long)value);
+        }
+    }
+    fprintf(out, "\r\n");
+}
+
+// Returns a temporary file with the data of the blocks, without the trailers
+static FILE *strip_trailers(FILE *f) {
+    uint8_t block[LOG_FORMAT_BLOCK_SIZE];
+    size_t length;
+    FILE *data = tmpfile();
+    
+    if (data == NULL) {
+        return NULL;
+    }
+    while ((length = fread(block, 1, LOG_FORMAT_BLOCK_SIZE, f)) != 0) {
+        // The last block can be incomplete, it has no trailer yet
+        if (length == LOG_FORMAT_BLOCK_SIZE) {
+            length -= LOG_FORMAT_TRAILER_SIZE;
+        }
+        fwrite(block, 1, length, data);
+    }
+    rewind(data);
+    return data;
+}
+
+// Decodes delta records. Records before the first keyframe can not be decoded and are skipped.
+static void export_delta(FILE *f, FILE *out, uint8_t *record) {
+    uint8_t have_keyframe = 0;
+    long position;
+    int c;
+    
+    while ((c = fgetc(f)) != EOF) {
+        if (c == LOG_FORMAT_PADDING) {
+            // Continue at the next block
+            position = ftell(f);
+            position = (position + block_data_size - 1) / block_data_size * block_data_size;
+            fseek(f, position, SEEK_SET);
+        } else if (c & LOG_FORMAT_KEYFRAME) {
+            record[0] = c;
+            if (read_bytes(f, &record[1], record_size - 1) != 0) {
+                break;
+            }
+            print_record(out, unpack_record(record));
+            have_keyframe = 1;
+        } else {
+            if (decode_delta(f, c) != 0) {
+                break;
+            }
+            if (have_keyframe) {
+                print_record(out, c);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    FILE *f, *data;
+    uint8_t *record;
+    uint8_t header[5];
+    
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s LOGn.BIN > LOGn.CSV\n", argv[0]);
+        return 1;
+    }
+    f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    
+    // From version 3 on the blocks end with a trailer
+    if (fread(header, 1, sizeof(header), f) == sizeof(header) && header[4] >= 3) {
+        rewind(f);
+        data = strip_trailers(f);
+        fclose(f);
+        if (data == NULL) {
+            perror("tmpfile");
+            return 1;
+        }
+        f = data;
+        block_data_size = LOG_FORMAT_BLOCK_SIZE - LOG_FORMAT_TRAILER_SIZE;
+    }
+    rewind(f);
+    
+    if (read_schema(f) != 0) {
+        fclose(f);
+        return 1;
+    }
+    
+    record = malloc(record_size);
+    if (record == NULL) {
+        fclose(f);
+        return 1;
+    }
+    print_header(stdout);
+    if (encoding == LOG_FORMAT_ENCODING_DELTA) {
+        export_delta(f, stdout, record);
+    } else {
+        while (read_bytes(f, record, record_size) == 0) {
+            print_record(stdout, unpack_record(record));
+        }
+    }
+    
+    free(record);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * File:   log_verify.c
+ *
+ * Checks the block trailers of binary log files (LOGn.BIN, version 3 and up).
+ * Every block of LOG_FORMAT_BLOCK_SIZE bytes ends with a sequence number and
+ * a CRC 16, see log_format.h. Blocks with a wrong CRC are reported as corrupt,
+ * gaps in the sequence numbers as missing blocks. The sequence counts on over
+ * the files of a session, so the files of one session directory are checked
+ * together, in the order of their number.
+ *
+ * Build:  gcc -O2 -Wall -o log_verify log_verify.c
+ * Usage:  log_verify LOGS/S3/LOG*.BIN
+ *         log_verify -b       compares the speed of the CRC implementations
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "../Software/log_format.h"
+
+#define CRC_POLY            0x1021
+#define CRC_START           0x1D0F
+#define READ_BLOCKS         2048        // Blocks per read, 1 MB
+#define BENCHMARK_SIZE      (64UL << 20)
+
+// crc_table[0] is the usual byte table. crc_table[k] gives the CRC of a byte
+// followed by k zero bytes, so 8 bytes are done with 8 independent lookups.
+static uint16_t crc_table[8][256];
+
+static void crc_init(void) {
+    uint16_t i, k, crc;
+
+    for (i = 0; i < 256; i++) {
+        crc = i << 8;
+        for (k = 0; k < 8; k++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ CRC_POLY : crc << 1;
+        }
+        crc_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 8; k++) {
+            crc = crc_table[k - 1][i];
+            crc_table[k][i] = (crc << 8) ^ crc_table[0][crc >> 8];
+        }
+    }
+}
+
+// Same as the firmware before the table: 8 shift and xor steps per byte
+static uint16_t crc_bitwise(const uint8_t *data, size_t length) {
+    uint16_t crc = CRC_START;
+    uint8_t k;
+
+    while (length-- != 0) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (k = 0; k < 8; k++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ CRC_POLY : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// Same as utl_calc_crc() in the firmware
+static uint16_t crc_table_driven(const uint8_t *data, size_t length) {
+    uint16_t crc = CRC_START;
+
+    while (length-- != 0) {
+        crc = (crc << 8) ^ crc_table[0][(uint8_t)(crc >> 8) ^ *data++];
+    }
+    return crc;
+}
+
+static uint16_t crc_slice8(const uint8_t *data, size_t length) {
+    uint16_t crc = CRC_START;
+
+    while (length >= 8) {
+        crc = crc_table[7][(crc >> 8) ^ data[0]] ^ crc_table[6][(crc & 0xFF) ^ data[1]] ^
+                crc_table[5][data[2]] ^ crc_table[4][data[3]] ^ crc_table[3][data[4]] ^
+                crc_table[2][data[5]] ^ crc_table[1][data[6]] ^ crc_table[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- != 0) {
+        crc = (crc << 8) ^ crc_table[0][(uint8_t)(crc >> 8) ^ *data++];
+    }
+    return crc;
+}
+
+static int benchmark(void) {
+    static const char *names[] = {"bitwise", "table", "slice-by-8"};
+    uint16_t (*functions[])(const uint8_t *, size_t) = {crc_bitwise, crc_table_driven, crc_slice8};
+    uint16_t crc[3];
+    uint8_t *data = malloc(BENCHMARK_SIZE);
+    size_t i, offset;
+    clock_t start;
+    double seconds;
+
+    if (data == NULL) {
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < BENCHMARK_SIZE; i++) {
+        data[i] = rand();
+    }
+    for (i = 0; i < 3; i++) {
+        start = clock();
+        crc[i] = 0;
+        // Block by block, as the logger does
+        for (offset = 0; offset < BENCHMARK_SIZE; offset += LOG_FORMAT_BLOCK_SIZE) {
+            crc[i] ^= functions[i](&data[offset], LOG_FORMAT_BLOCK_SIZE - 2);
+        }
+        seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("%-12s %8.1f MB/s\n", names[i], BENCHMARK_SIZE / 1e6 / (seconds > 0 ? seconds : 1e-9));
+    }
+    free(data);
+    if (crc[0] != crc[1] || crc[0] != crc[2]) {
+        printf("CRC mismatch\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Compares names with the numbers in them by value, so LOG10 comes after LOG9
+static int compare_names(const void *a, const void *b) {
+    const char *s = *(const char * const *)a;
+    const char *t = *(const char * const *)b;
+    unsigned long m, n;
+
+    while (*s != '\0' && *t != '\0') {
+        if (isdigit((unsigned char)*s) && isdigit((unsigned char)*t)) {
+            m = strtoul(s, (char **)&s, 10);
+            n = strtoul(t, (char **)&t, 10);
+            if (m != n) {
+                return m < n ? -1 : 1;
+            }
+        } else {
+            if (*s != *t) {
+                return (unsigned char)*s - (unsigned char)*t;
+            }
+            s++;
+            t++;
+        }
+    }
+    return (unsigned char)*s - (unsigned char)*t;
+}
+
+// Returns the length of the directory part of a path
+static size_t directory_length(const char *path) {
+    const char *slash = strrchr(path, '/');
+
+    return slash == NULL ? 0 : (size_t)(slash - path + 1);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint8_t blocks[READ_BLOCKS * LOG_FORMAT_BLOCK_SIZE];
+static unsigned long total_blocks, total_corrupt, total_missing;
+
+// Checks the blocks of one file. expected is the next sequence number,
+// -1 when it is not known yet. Returns -1 when the file can not be read.
+static int verify_file(const char *path, int64_t *expected) {
+    FILE *f = fopen(path, "rb");
+    unsigned long block = 0, corrupt = 0, missing = 0;
+    size_t length, offset;
+    const uint8_t *p;
+    uint32_t sequence;
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    length = fread(blocks, 1, LOG_FORMAT_BLOCK_SIZE, f);
+    if (length < 5 || memcmp(blocks, LOG_FORMAT_MAGIC, 4) != 0 || blocks[4] < 3) {
+        fprintf(stderr, "%s: not a binary log file with block trailers\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    do {
+        for (offset = 0; offset + LOG_FORMAT_BLOCK_SIZE <= length; offset += LOG_FORMAT_BLOCK_SIZE, block++) {
+            p = &blocks[offset];
+            if (crc_slice8(p, LOG_FORMAT_BLOCK_SIZE - 2) != (p[LOG_FORMAT_BLOCK_SIZE - 2] | p[LOG_FORMAT_BLOCK_SIZE - 1] << 8)) {
+                printf("%s: block %lu corrupt\n", path, block);
+                corrupt++;
+                if (*expected >= 0) {
+                    (*expected)++;
+                }
+                continue;
+            }
+            sequence = get_u32(&p[LOG_FORMAT_BLOCK_SIZE - LOG_FORMAT_TRAILER_SIZE]);
+            if (*expected >= 0 && sequence != *expected) {
+                if (sequence > *expected) {
+                    printf("%s: block %lu, sequence %lld to %lu missing\n", path, block,
+                            (long long)*expected, (unsigned long)sequence - 1);
+                    missing += sequence - *expected;
+                } else {
+                    printf("%s: block %lu, sequence goes back from %lld to %lu\n", path, block,
+                            (long long)*expected, (unsigned long)sequence);
+                }
+            }
+            *expected = (int64_t)sequence + 1;
+        }
+        // Only the last block of the file can be incomplete
+        if (offset != length) {
+            break;
+        }
+        length = fread(blocks, 1, sizeof(blocks), f);
+    } while (length != 0);
+
+    if (ferror(f)) {
+        perror(path);
+    }
+    fclose(f);
+    printf("%s: %lu blocks, %lu corrupt, %lu missing\n", path, block, corrupt, missing);
+    total_blocks += block;
+    total_corrupt += corrupt;
+    total_missing += missing;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int64_t expected = -1;
+    int i, errors = 0;
+
+    crc_init();
+    if (argc == 2 && strcmp(argv[1], "-b") == 0) {
+        return benchmark();
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s LOGn.BIN ...\n       %s -b\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    qsort(&argv[1], argc - 1, sizeof(char *), compare_names);
+    for (i = 1; i < argc; i++) {
+        // Each session directory starts counting again
+        if (i > 1 && (directory_length(argv[i]) != directory_length(argv[i - 1]) ||
+                strncmp(argv[i], argv[i - 1], directory_length(argv[i])) != 0)) {
+            expected = -1;
+        }
+        if (verify_file(argv[i], &expected) != 0) {
+            errors++;
+        }
+    }
+    if (argc > 2) {
+        printf("Total: %lu blocks, %lu corrupt, %lu missing\n", total_blocks, total_corrupt, total_missing);
+    }
+    return (errors != 0 || total_corrupt != 0 || total_missing != 0) ? 1 : 0;
+}
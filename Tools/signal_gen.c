@@ -0,0 +1,551 @@
+/*
+ * File:   signal_gen.c
+ *
+ * Generates Software/can_signals.h from the signal sheet Software/can_signals.csv.
+ * The sheet has a line for every value decoded from the CAN bus, with the
+ * field it is stored in, where it is in the frame and its log column. The
+ * header holds X-macro tables for the storage structs, the CANopen and J1939
+ * decode tables of canbus.c, sorted for its binary search, the log columns of log_row.c,
+ * the signals with min, max and mean columns and the triggers of the raw capture.
+ *
+ * Build:  gcc -O2 -Wall -o signal_gen signal_gen.c
+ * Usage:  signal_gen can_signals.csv > can_signals.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_SIGNALS     512
+#define MAX_STRUCTS     32
+#define MAX_FIELDS      256
+#define MAX_NAME        64
+#define MAX_LINE        512
+#define MAX_BLOCK       16          // Lines repeated together
+#define SHEET_FIELDS    15
+#define EOL             "\r\n"      // Line ending of the firmware sources
+
+#define PROTOCOL_CANOPEN    0
+#define PROTOCOL_J1939      1
+
+typedef struct {
+    char target[MAX_NAME];
+    char column[MAX_NAME];          // Empty when the value is not logged
+    char can_type[16];
+    char log_type[16];
+    char group[16];
+    int protocol;                   // PROTOCOL_*, the first key of the sort
+    long id;                        // COB-ID or PGN
+    long index;                     // CANopen index or J1939 source address
+    long sub_index;
+    long offset;
+    long can_scale;
+    long log_scale;
+    int aggregate;                  // Position in the aggregate table, -1 when not aggregated
+    int trigger;                    // Position in the trigger table, -1 without trigger
+    char trigger_kind[16];
+    long trigger_step;
+    int line;
+    int order;                      // Position in the sheet, keeps the sort stable
+} signal_t;
+
+typedef struct {
+    char name[MAX_NAME];
+    int count;                      // 0 for a single struct, else the array size
+} struct_t;
+
+typedef struct {
+    int parent;                     // Index in structs
+    char name[MAX_NAME];
+    const char *type;
+    int count;                      // 0 for a single field, else the array size
+} field_t;
+
+static const struct {
+    const char *name;
+    const char *c_type;
+} can_types[] = {
+    {"U8", "uint8_t"},
+    {"U16", "uint16_t"},
+    {"U32", "uint32_t"},
+    {"I16", "int16_t"},
+    {"FLOAT_U16", "uint16_t"},
+    {"FLOAT_I16", "int16_t"},
+};
+
+#define CAN_TYPES   ((int)(sizeof(can_types) / sizeof(can_types[0])))
+
+static const char *protocols[] = {"CANOPEN", "J1939"};
+static const char *log_types[] = {"U8", "U16", "U32", "I8", "I16", "I32"};
+static const char *groups[] = {"LOGGER", "GPS", "BATTERY", "CELLS", "MPPT", "SLS", "FOIL"};
+static const char *statistics[] = {"min", "max", "mean"};
+static const char *trigger_kinds[] = {"CHANGE", "SET", "STEP"};
+
+static signal_t signals[MAX_SIGNALS];
+static int signal_count;
+static int aggregate_count;
+static int trigger_count;
+static int sorted[MAX_SIGNALS];             // Indexes of signals sorted by the key
+static struct_t structs[MAX_STRUCTS];
+static int struct_count;
+static field_t fields[MAX_FIELDS];
+static int field_count;
+static const char *sheet_name;
+
+static void fail(int line, const char *message, const char *detail) {
+    fprintf(stderr, "%s:%d: %s%s%s\n", sheet_name, line, message, detail[0] ? ": " : "", detail);
+    exit(1);
+}
+
+static int find_name(const char *name, const char *const *names, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Splits a line at the semicolons. Spaces are kept, they are part of the column names.
+static int split(char *line, char **parts, int max) {
+    int count = 0;
+
+    parts[count++] = line;
+    while ((line = strchr(line, ';')) != NULL && count < max) {
+        *line++ = '\0';
+        parts[count++] = line;
+    }
+    return count;
+}
+
+// A number, optionally followed by +n
+static long parse_number(const char *text, int n, int line) {
+    char *end;
+    long value = strtol(text, &end, 0);
+
+    if (end == text) {
+        fail(line, "not a number", text);
+    }
+    if (strcmp(end, "+n") == 0) {
+        value += n;
+    } else if (*end != '\0') {
+        fail(line, "not a number", text);
+    }
+    return value;
+}
+
+// Copies text with {n} replaced by n and {n+1} by n + 1
+static void substitute(char *out, const char *text, int n, int line) {
+    char *start = out;
+
+    while (*text != '\0') {
+        if (strncmp(text, "{n}", 3) == 0) {
+            out += sprintf(out, "%d", n);
+            text += 3;
+        } else if (strncmp(text, "{n+1}", 5) == 0) {
+            out += sprintf(out, "%d", n + 1);
+            text += 5;
+        } else {
+            *out++ = *text++;
+        }
+        if (out - start >= MAX_NAME - 8) {
+            fail(line, "text too long", "");
+        }
+    }
+    *out = '\0';
+}
+
+static void add_signal(char **parts, int n, int line) {
+    signal_t *signal;
+
+    if (signal_count == MAX_SIGNALS) {
+        fail(line, "too many signals", "");
+    }
+    signal = &signals[signal_count];
+    signal->line = line;
+    signal->order = signal_count;
+    substitute(signal->target, parts[0], n, line);
+    signal->protocol = find_name(parts[1], protocols, sizeof(protocols) / sizeof(protocols[0]));
+    if (signal->protocol < 0) {
+        fail(line, "unknown protocol", parts[1]);
+    }
+    signal->id = parse_number(parts[2], n, line);
+    signal->index = parse_number(parts[3], n, line);
+    signal->sub_index = parse_number(parts[4], n, line);
+    signal->offset = parse_number(parts[5], n, line);
+    snprintf(signal->can_type, sizeof(signal->can_type), "%s", parts[6]);
+    signal->can_scale = parse_number(parts[7], n, line);
+    substitute(signal->column, parts[8], n, line);
+    if (signal->column[0] != '\0') {
+        snprintf(signal->log_type, sizeof(signal->log_type), "%s", parts[9]);
+        signal->log_scale = parse_number(parts[10], n, line);
+        snprintf(signal->group, sizeof(signal->group), "%s", parts[11]);
+    }
+    signal->aggregate = -1;
+    if (parts[12][0] != '\0') {
+        if (strcmp(parts[12], "1") != 0) {
+            fail(line, "aggregate needs to be empty or 1", parts[12]);
+        }
+        signal->aggregate = aggregate_count++;
+    }
+    // CHANGE, SET or STEP followed by the size of the step
+    signal->trigger = -1;
+    signal->trigger_step = 0;
+    if (parts[13][0] != '\0') {
+        if (strncmp(parts[13], "STEP ", 5) == 0) {
+            signal->trigger_step = parse_number(&parts[13][5], n, line);
+            parts[13][4] = '\0';
+        }
+        if (find_name(parts[13], trigger_kinds, sizeof(trigger_kinds) / sizeof(trigger_kinds[0])) < 0) {
+            fail(line, "trigger needs to be empty, CHANGE, SET or STEP <size>", parts[13]);
+        }
+        snprintf(signal->trigger_kind, sizeof(signal->trigger_kind), "%s", parts[13]);
+        signal->trigger = trigger_count++;
+    }
+    signal_count++;
+}
+
+// Reads the sheet. Consecutive lines with the same repeat count form a block,
+// which is added for n = 0 to repeat - 1.
+static void read_sheet(FILE *f) {
+    static char block[MAX_BLOCK][MAX_LINE];
+    static char text[MAX_LINE], copy[MAX_LINE];
+    char *parts[SHEET_FIELDS + 1];
+    int block_lines[MAX_BLOCK];
+    int line = 0, header = 0, lines = 0, repeat = 0, count = 0, done, n, i;
+
+    do {
+        done = fgets(text, sizeof(text), f) == NULL;
+        if (!done) {
+            line++;
+            text[strcspn(text, "\r\n")] = '\0';
+            if (text[0] == '#' || text[0] == '\0') {
+                continue;
+            }
+            if (!header) {
+                // The first line names the fields
+                header = 1;
+                continue;
+            }
+            if (split(strcpy(copy, text), parts, SHEET_FIELDS + 1) != SHEET_FIELDS) {
+                fail(line, "expected 15 fields", "");
+            }
+            count = parts[14][0] != '\0' ? (int)parse_number(parts[14], 0, line) : 1;
+            if (count < 1) {
+                fail(line, "repeat needs to be at least 1", "");
+            }
+        }
+
+        if (lines != 0 && (done || count != repeat || repeat == 1)) {
+            for (n = 0; n < repeat; n++) {
+                for (i = 0; i < lines; i++) {
+                    split(strcpy(copy, block[i]), parts, SHEET_FIELDS);
+                    add_signal(parts, n, block_lines[i]);
+                }
+            }
+            lines = 0;
+        }
+        if (!done) {
+            if (lines == MAX_BLOCK) {
+                fail(line, "too many lines repeated together", "");
+            }
+            strcpy(block[lines], text);
+            block_lines[lines++] = line;
+            repeat = count;
+        }
+    } while (!done);
+}
+
+// Splits a target like mg_mppt[3].voltage_in_mv or mg_battery.temp[2]
+static void parse_target(const signal_t *signal, char *parent, int *parent_index, char *field, int *field_index) {
+    const char *p = signal->target;
+    char *out;
+    int part;
+
+    for (part = 0; part < 2; part++) {
+        out = part == 0 ? parent : field;
+        if (!isalpha((unsigned char)*p) && *p != '_') {
+            fail(signal->line, "bad target", signal->target);
+        }
+        while (isalnum((unsigned char)*p) || *p == '_') {
+            *out++ = *p++;
+        }
+        *out = '\0';
+        *(part == 0 ? parent_index : field_index) = -1;
+        if (*p == '[') {
+            *(part == 0 ? parent_index : field_index) = (int)strtol(p + 1, (char **)&p, 10);
+            if (*p++ != ']') {
+                fail(signal->line, "bad target", signal->target);
+            }
+        }
+        if (part == 0 && *p++ != '.') {
+            fail(signal->line, "target needs to be struct.field", signal->target);
+        }
+    }
+    if (*p != '\0') {
+        fail(signal->line, "bad target", signal->target);
+    }
+}
+
+static void check_signal(const signal_t *signal) {
+    char parent[MAX_NAME], field[MAX_NAME];
+    int parent_index, field_index, type, s, f;
+
+    for (type = 0; type < CAN_TYPES && strcmp(signal->can_type, can_types[type].name) != 0; type++);
+    if (type == CAN_TYPES) {
+        fail(signal->line, "unknown type", signal->can_type);
+    }
+    // utl_float_to_fixed() converts floats with integer math for these scales
+    if (strncmp(signal->can_type, "FLOAT_", 6) == 0 && (signal->can_scale < -3 || signal->can_scale > 3)) {
+        fail(signal->line, "the scale of a float needs to be between -3 and 3", signal->target);
+    }
+    if (signal->protocol == PROTOCOL_CANOPEN) {
+        if (signal->id < 0 || signal->id > 0x7FF || signal->index < 0 || signal->index > 0xFFFF ||
+                signal->sub_index < 0 || signal->sub_index > 0xFF || signal->offset < 0 || signal->offset > 7) {
+            fail(signal->line, "COB-ID, index, sub-index or offset out of range", "");
+        }
+    } else {
+        // Messages of more than 8 bytes come in with the transport protocol
+        if (signal->id < 0 || signal->id > 0x3FFFF || signal->index < 0 || signal->index > 0xFF ||
+                signal->sub_index != 0 || signal->offset < 0 || signal->offset > 0xFF) {
+            fail(signal->line, "PGN, source address, sub-index or offset out of range", "");
+        }
+        // PDU1 PGNs hold the destination address in the low byte, which is not part of the PGN
+        if (((signal->id >> 8) & 0xFF) < 240 && (signal->id & 0xFF) != 0) {
+            fail(signal->line, "the low byte of a PDU1 PGN needs to be 0", "");
+        }
+    }
+    if (signal->column[0] != '\0') {
+        if (find_name(signal->log_type, log_types, sizeof(log_types) / sizeof(log_types[0])) < 0) {
+            fail(signal->line, "unknown log type", signal->log_type);
+        }
+        if (find_name(signal->group, groups, sizeof(groups) / sizeof(groups[0])) < 0) {
+            fail(signal->line, "unknown group", signal->group);
+        }
+        if (strpbrk(signal->column, "\"\\") != NULL) {
+            fail(signal->line, "column names can not hold quotes or backslashes", signal->column);
+        }
+    }
+    // The sums of the aggregates are kept in 32 bits
+    if (signal->aggregate >= 0 && (signal->column[0] == '\0' || strcmp(signal->can_type, "U32") == 0)) {
+        fail(signal->line, "only logged values of 16 bits or less can be aggregated", signal->target);
+    }
+    // Triggers compare the values in 32 bits
+    if (strcmp(signal->trigger_kind, "STEP") == 0 && (signal->trigger_step <= 0 || strcmp(signal->can_type, "U32") == 0)) {
+        fail(signal->line, "a step trigger needs a step of at least 1 and a value of 16 bits or less", signal->target);
+    }
+
+    // Collect the structs and their fields in the order of the sheet
+    parse_target(signal, parent, &parent_index, field, &field_index);
+    for (s = 0; s < struct_count && strcmp(structs[s].name, parent) != 0; s++);
+    if (s == struct_count) {
+        if (struct_count == MAX_STRUCTS) {
+            fail(signal->line, "too many structs", "");
+        }
+        strcpy(structs[s].name, parent);
+        structs[s].count = 0;
+        struct_count++;
+    }
+    if (parent_index >= structs[s].count) {
+        structs[s].count = parent_index + 1;
+    }
+    for (f = 0; f < field_count && (fields[f].parent != s || strcmp(fields[f].name, field) != 0); f++);
+    if (f == field_count) {
+        if (field_count == MAX_FIELDS) {
+            fail(signal->line, "too many fields", "");
+        }
+        fields[f].parent = s;
+        strcpy(fields[f].name, field);
+        fields[f].type = can_types[type].c_type;
+        fields[f].count = 0;
+        field_count++;
+    } else if (strcmp(fields[f].type, can_types[type].c_type) != 0) {
+        fail(signal->line, "field stored with another type before", signal->target);
+    }
+    if (field_index >= fields[f].count) {
+        fields[f].count = field_index + 1;
+    }
+}
+
+static int compare_signals(const void *a, const void *b) {
+    const signal_t *s = &signals[*(const int *)a];
+    const signal_t *t = &signals[*(const int *)b];
+
+    if (s->protocol != t->protocol) {
+        return s->protocol - t->protocol;
+    }
+    if (s->id != t->id) {
+        return s->id < t->id ? -1 : 1;
+    }
+    if (s->index != t->index) {
+        return s->index < t->index ? -1 : 1;
+    }
+    if (s->sub_index != t->sub_index) {
+        return s->sub_index < t->sub_index ? -1 : 1;
+    }
+    return s->order - t->order;
+}
+
+static void print_dims(int count) {
+    if (count > 0) {
+        printf("[%d]", count);
+    }
+}
+
+// Prints the decode table of one protocol
+static void print_signal_table(int protocol, const char *name) {
+    const signal_t *signal;
+    int i;
+
+    printf("#define %s(X)", name);
+    for (i = 0; i < signal_count; i++) {
+        signal = &signals[sorted[i]];
+        if (signal->protocol == protocol) {
+            printf(" \\" EOL "    X(0x%03lX, 0x%04lX, 0x%02lX, %ld, CAN_TYPE_%s, %ld, %s, %d, %d)", signal->id, signal->index, signal->sub_index, signal->offset, signal->can_type,
+                    signal->can_scale, signal->target, signal->aggregate, signal->trigger);
+        }
+    }
+    printf(EOL EOL);
+}
+
+static void print_header(void) {
+    static int position[MAX_SIGNALS];
+    int s, f, i, count[2] = {0, 0};
+
+    printf("/*" EOL);
+    printf(" * File:                can_signals.h" EOL);
+    printf(" * Comments:            Generated by Tools/signal_gen from can_signals.csv, do not edit." EOL);
+    printf(" */" EOL EOL);
+    printf("#ifndef CAN_SIGNALS_H" EOL);
+    printf("#define\tCAN_SIGNALS_H" EOL EOL);
+
+    printf("// Structs with the decoded values, S(name, dims). Dims is empty or the array size." EOL);
+    printf("#define CAN_STRUCTS(S) \\" EOL);
+    for (s = 0; s < struct_count; s++) {
+        printf("    S(%s, ", structs[s].name);
+        print_dims(structs[s].count);
+        printf(")%s" EOL, s + 1 < struct_count ? " \\" : "");
+    }
+    printf(EOL);
+
+    printf("// Fields of each struct, F(type, name, dims)" EOL);
+    for (s = 0; s < struct_count; s++) {
+        printf("#define CAN_FIELDS_%s(F) \\" EOL, structs[s].name);
+        for (f = 0, i = 0; f < field_count; f++) {
+            if (fields[f].parent == s) {
+                if (i++ != 0) {
+                    printf(" \\" EOL);
+                }
+                printf("    F(%s, %s, ", fields[f].type, fields[f].name);
+                print_dims(fields[f].count);
+                printf(")");
+            }
+        }
+        printf(EOL EOL);
+    }
+
+    for (i = 0; i < signal_count; i++) {
+        count[signals[i].protocol]++;
+    }
+    printf("// Decoded values, X(id, index, sub_index, offset, type, scale, target, aggregate, trigger)." EOL);
+    printf("// Aggregate is the position in CAN_AGGREGATE_TABLE, -1 when the value is not aggregated." EOL);
+    printf("// Trigger is the position in CAN_TRIGGER_TABLE, -1 when the value has no trigger." EOL);
+    printf("// CANopen values sorted by COB-ID, index and sub-index" EOL);
+    printf("#define CAN_CANOPEN_SIGNALS     %d" EOL, count[PROTOCOL_CANOPEN]);
+    print_signal_table(PROTOCOL_CANOPEN, "CAN_CANOPEN_TABLE");
+    printf("// J1939 values sorted by PGN and source address, sub-index is always 0" EOL);
+    printf("#define CAN_J1939_SIGNALS       %d" EOL, count[PROTOCOL_J1939]);
+    print_signal_table(PROTOCOL_J1939, "CAN_J1939_TABLE");
+
+    // The position of each signal in the sorted table, the CANopen values come first
+    for (i = 0; i < signal_count; i++) {
+        position[sorted[i]] = i;
+    }
+    printf("// Log columns of the decoded values, X(name, type, scale, group, value, signal)." EOL);
+    printf("// Signal is the position of the value in CAN_CANOPEN_TABLE followed by CAN_J1939_TABLE." EOL);
+    printf("#define CAN_COLUMN_TABLE(X) \\" EOL);
+    for (i = 0, f = 0; i < signal_count; i++) {
+        if (signals[i].column[0] != '\0') {
+            if (f++ != 0) {
+                printf(" \\" EOL);
+            }
+            printf("    X(\"%s\", LOG_TYPE_%s, %ld, LOG_GROUP_%s, %s, %d)", signals[i].column, signals[i].log_type,
+                    signals[i].log_scale, signals[i].group, signals[i].target, position[i]);
+        }
+    }
+    printf(EOL EOL);
+
+    printf("// Values with a running min, max and mean, X(aggregate, group)" EOL);
+    printf("#define CAN_AGGREGATES  %d" EOL, aggregate_count);
+    printf("#define CAN_AGGREGATE_TABLE(X) \\" EOL);
+    for (i = 0, f = 0; i < signal_count; i++) {
+        if (signals[i].aggregate >= 0) {
+            if (f++ != 0) {
+                printf(" \\" EOL);
+            }
+            printf("    X(%d, LOG_GROUP_%s)", signals[i].aggregate, signals[i].group);
+        }
+    }
+    printf(EOL EOL);
+
+    printf("// Log columns of the aggregates, X(name, type, scale, group, aggregate, statistic)." EOL);
+    printf("// Statistic is the field of can_bus_aggregate_t." EOL);
+    printf("#define CAN_AGGREGATE_COLUMN_TABLE(X) \\" EOL);
+    for (i = 0, f = 0; i < signal_count; i++) {
+        if (signals[i].aggregate >= 0) {
+            for (s = 0; s < 3; s++) {
+                if (f++ != 0) {
+                    printf(" \\" EOL);
+                }
+                printf("    X(\"%s %s\", LOG_TYPE_%s, %ld, LOG_GROUP_%s, %d, %s)", signals[i].column, statistics[s],
+                        signals[i].log_type, signals[i].log_scale, signals[i].group, signals[i].aggregate, statistics[s]);
+            }
+        }
+    }
+    printf(EOL EOL);
+
+    printf("// Values that start a raw capture window, X(trigger, kind, step). Kind is CAN_TRIGGER_*" EOL);
+    printf("// from canbus.h, step the change that fires a CAN_TRIGGER_STEP trigger." EOL);
+    printf("#define CAN_TRIGGERS    %d" EOL, trigger_count);
+    printf("#define CAN_TRIGGER_TABLE(X) \\" EOL);
+    for (i = 0, f = 0; i < signal_count; i++) {
+        if (signals[i].trigger >= 0) {
+            if (f++ != 0) {
+                printf(" \\" EOL);
+            }
+            printf("    X(%d, CAN_TRIGGER_%s, %ld)", signals[i].trigger, signals[i].trigger_kind, signals[i].trigger_step);
+        }
+    }
+    printf(EOL EOL);
+    printf("#endif\t/* CAN_SIGNALS_H */" EOL);
+}
+
+int main(int argc, char *argv[]) {
+    FILE *f;
+    int i;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s can_signals.csv > can_signals.h\n", argv[0]);
+        return 1;
+    }
+    sheet_name = argv[1];
+    f = fopen(sheet_name, "r");
+    if (f == NULL) {
+        perror(sheet_name);
+        return 1;
+    }
+    read_sheet(f);
+    fclose(f);
+
+    for (i = 0; i < signal_count; i++) {
+        check_signal(&signals[i]);
+        sorted[i] = i;
+    }
+    qsort(sorted, signal_count, sizeof(int), compare_signals);
+    print_header();
+    return 0;
+}